@@ -0,0 +1,191 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * An offline list of allowed cards, held in EEPROM
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "allowlist.h"
+#include "arduino_cardreader.h"
+#include "card.h"
+#include "hexdump.h"
+#include "ledtimer.h"
+#include "outbuf.h"
+#include "packets.h"
+
+// The EEPROM layout is a small header followed by the sorted keys
+#define EE_MAGIC    0
+#define EE_FLAGS    1
+#define EE_COUNT    2   // u16, little endian
+#define EE_KEYS     4
+
+#define MAGIC           0xa1
+#define FLAG_ENABLED    0x01
+
+static bool valid() {
+    return EEPROM.read(EE_MAGIC) == MAGIC;
+}
+
+static void set_count(uint16_t count) {
+    EEPROM.update(EE_COUNT, count & 0xff);
+    EEPROM.update(EE_COUNT + 1, count >> 8);
+}
+
+static uint16_t capacity() {
+    return (EEPROM.length() - EE_KEYS) / ALLOWLIST_KEY_SIZE;
+}
+
+// Compare the key to the one stored at index
+static int8_t compare_key(uint16_t index, uint8_t *key) {
+    uint16_t addr = EE_KEYS + index * ALLOWLIST_KEY_SIZE;
+    for (uint8_t i = 0; i < ALLOWLIST_KEY_SIZE; i++) {
+        uint8_t stored = EEPROM.read(addr + i);
+        if (key[i] != stored) {
+            return (key[i] < stored) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+uint16_t allowlist_count() {
+    if (!valid()) {
+        return 0;
+    }
+    return EEPROM.read(EE_COUNT) | (EEPROM.read(EE_COUNT + 1) << 8);
+}
+
+bool allowlist_enabled() {
+    return valid() && (EEPROM.read(EE_FLAGS) & FLAG_ENABLED);
+}
+
+void allowlist_enable(bool enable) {
+    if (!valid()) {
+        allowlist_clear();
+    }
+    EEPROM.update(EE_FLAGS, enable ? FLAG_ENABLED : 0);
+}
+
+void allowlist_clear() {
+    set_count(0);
+    if (!valid()) {
+        EEPROM.update(EE_FLAGS, 0);
+        EEPROM.update(EE_MAGIC, MAGIC);
+    }
+}
+
+bool allowlist_add(uint8_t *hex, uint8_t hexlen) {
+    uint8_t key[ALLOWLIST_KEY_SIZE];
+    if (hexparse(key, sizeof(key), hex, hexlen) != sizeof(key)) {
+        return false;
+    }
+
+    uint16_t count = allowlist_count();
+    if (!valid() || count >= capacity()) {
+        return false;
+    }
+    if (count && compare_key(count - 1, key) <= 0) {
+        // Keeping the list sorted is the job of the host
+        return false;
+    }
+
+    uint16_t addr = EE_KEYS + count * ALLOWLIST_KEY_SIZE;
+    for (uint8_t i = 0; i < sizeof(key); i++) {
+        EEPROM.update(addr + i, key[i]);
+    }
+    set_count(count + 1);
+    return true;
+}
+
+static bool search(uint8_t *key) {
+    uint16_t lo = 0;
+    uint16_t hi = allowlist_count();
+
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        int8_t cmp = compare_key(mid, key);
+        if (cmp == 0) {
+            return true;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return false;
+}
+
+bool allowlist_check(Card& card) {
+    uint8_t key[ALLOWLIST_KEY_SIZE];
+
+    if (card.info_type != INFO_TYPE_NONE) {
+        // The card already holds its serial in the same form as the key
+        key[0] = card.info_type;
+        key[1] = card.info_len;
+        memcpy(&key[2], card.info, sizeof(card.info));
+        if (search(key)) {
+            return true;
+        }
+    }
+
+    if (card.uid_type > UID_TYPE_UNKNOWN) {
+        memset(key, 0, sizeof(key));
+        key[0] = card.uid_type;
+        key[1] = card.uid_len;
+        memcpy(&key[2], card.uid, card.uid_len);
+        if (search(key)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void allowlist_decide(Card& card) {
+    if (!allowlist_enabled()) {
+        return;
+    }
+    if (card.info_type == INFO_TYPE_NONE && card.uid_type <= UID_TYPE_UNKNOWN) {
+        // Nothing to decide on
+        return;
+    }
+
+    bool allow = allowlist_check(card);
+
+    if (allow) {
+        led_set(0, LED_MODE_ON, ALLOWLIST_OPEN_MILLIS);
+        led_set(1, LED_MODE_OFF, 0);
+    } else {
+        led_set(0, LED_MODE_BLINK1, ALLOWLIST_DENY_MILLIS);
+        led_set(1, LED_MODE_BLINK2, ALLOWLIST_DENY_MILLIS);
+    }
+
+    if (output_flags & OUTPUT_BINARY) {
+        packet_event(outbuf, EVENT_DECISION, allow, NULL, 0, card.detected);
+        return;
+    }
+
+    packet_start(outbuf);
+    outbuf.print(F("decision="));
+    if (allow) {
+        outbuf.print(F("allow"));
+    } else {
+        outbuf.print(F("deny"));
+    }
+    packet_event_end(outbuf, card.detected);
+}
+
+void allowlist_print_status(Print& p) {
+    packet_start(p);
+    p.print(F("allowlist="));
+    p.print(allowlist_count());
+    p.print('/');
+    p.print(capacity());
+    if (allowlist_enabled()) {
+        p.print(F(",enabled"));
+    }
+    packet_end(p);
+}
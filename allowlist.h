@@ -0,0 +1,49 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * An offline list of allowed cards, held in EEPROM, so that the reader can
+ * open the door without waiting for the host.
+ *
+ * The list is a sorted array of fixed width keys, searched with a binary
+ * search.  Each key is ALLOWLIST_KEY_SIZE bytes:
+ *
+ *      u8  type        the uid_type, or the info_type for a decoded serial
+ *      u8  len         the number of UID bytes, or serial digits
+ *      u8  data[10]    the UID bytes, or the serial as packed BCD digits
+ *                      (most significant first), padded with zeros
+ *
+ * The keys are compared as plain byte strings, and the host is expected to
+ * load them in ascending order.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "card.h"
+
+#define ALLOWLIST_KEY_SIZE  12
+
+// How long the door stays open (or the denied lights blink) after a tap
+#define ALLOWLIST_OPEN_MILLIS   5000
+#define ALLOWLIST_DENY_MILLIS   3000
+
+bool allowlist_enabled();
+void allowlist_enable(bool enable);
+
+// Start a new, empty list
+void allowlist_clear();
+
+// Append a key, given as hex digits.  Returns false if the key is malformed,
+// out of order or there is no more space
+bool allowlist_add(uint8_t *hex, uint8_t hexlen);
+
+uint16_t allowlist_count();
+
+// Search for the card (by its serial or by its UID)
+bool allowlist_check(Card& card);
+
+// If enabled, decide on the card locally, set the LEDs and report it
+void allowlist_decide(Card& card);
+
+// Send the allowlist= status message
+void allowlist_print_status(Print& p);
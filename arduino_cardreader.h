@@ -11,6 +11,9 @@
 #define LED1 7  // Intended to show status + activity (maybe green?)
 #define LED2 8  // Reserved for showing an error (maybe red?)
 
+// How long the LEDs stay as set by a host command, unless it says otherwise
+#define LED_COMMAND_MILLIS 20000
+
 // This list of possible types for InAutoPoll results was taken from the table
 // in 7.3.13 of the Pn532 User Manual
 #define TYPE_MIFARE     0x10
@@ -21,4 +24,11 @@
 #define OUTPUT_RAWALL   1   // Always generate raw= messages
 #define OUTPUT_RAWTAG   2   // Always generate rawtag= messages
 #define OUTPUT_EXTRA    4   // Poll the card for extra data
+#define OUTPUT_TRACE    8   // Capture PN532 operations as trace= messages
+#define OUTPUT_BINARY   16  // Send card events as binary records
+#define OUTPUT_SEQ      32  // Add sequence numbers and times to card events
+#define OUTPUT_APDU     64  // Show each ISO7816 APDU as an apdu= message
 extern uint8_t output_flags;
+
+// The work that carries on while waiting for the PN532
+void idle_tasks(void);
@@ -13,116 +13,260 @@
 /**************************************************************************/
 #include <SPI.h>
 #include <Adafruit_PN532.h>
+#ifdef __AVR__
+#include <avr/wdt.h>
+#endif
 
+#include "allowlist.h"
 #include "arduino_cardreader.h"
 #include "byteops.h"        // for hexdump()
 #include "card.h"
+#include "card_felica.h"
 #include "card_iso14443.h"
 #include "card_iso7816.h"
 #include "card_mifare.h"
+#include "classify.h"
+#include "health.h"
 #include "hexdump.h"
 #include "ledtimer.h"
+#include "outbuf.h"
 #include "packets.h"
+#include "pn532.h"
+#include "presence.h"
+#include "scratch.h"
+#include "stats.h"
 
 #define PN532_SS   (10)
 
+// A second PN532 can share the SPI bus, with its own SS pin.  Build with
+// PN532_SS2 defined to its pin (eg -DPN532_SS2=9) to use one, as otherwise
+// the pin would be driven on boards that have something else on it.  It is
+// only used if it answers at boot.
+#ifdef PN532_SS2
+#define READERS_MAX 2
+#else
+#define READERS_MAX 1
+#endif
+
 // Note that the PN532 SCK, MOSI, and MISO pins need to be connected to the
 // Arduino's // hardware SPI SCK, MOSI, and MISO pins.  On an Arduino Uno these
 // are // SCK = 13, MOSI = 11, MISO = 12.  The SS line can be any digital IO
 // pin.
-Adafruit_PN532 nfc(PN532_SS);
+#ifdef PN532_SS2
+static const uint8_t reader_ss[READERS_MAX] = {PN532_SS, PN532_SS2};
+#else
+static const uint8_t reader_ss[READERS_MAX] = {PN532_SS};
+#endif
+
+// How each PN532 is reached.  One on a spare hardware UART could use a
+// PN532HSU here instead.
+#ifdef PN532_SS2
+static PN532SPI reader_bus[READERS_MAX] = {PN532SPI(PN532_SS), PN532SPI(PN532_SS2)};
+#else
+static PN532SPI reader_bus[READERS_MAX] = {PN532SPI(PN532_SS)};
+#endif
+
+// All card operations use these
+#ifdef PN532_SS2
+PN532 readers[READERS_MAX] = {PN532(reader_bus[0]), PN532(reader_bus[1])};
+#else
+PN532 readers[READERS_MAX] = {PN532(reader_bus[0])};
+#endif
+
+static uint8_t readers_fitted;  // A bit for each reader that answered at boot
+static uint8_t reader_next;     // The reader to look at first, next time
 
 uint8_t output_flags = 0;
 
-void setup(void) {
-#ifndef ESP8266
-    while (!Serial); // for Leonardo/Micro/Zero
+#define POLLDATA_SIZE 64
+
+// A Leonardo/Micro/Zero can wait for the USB serial port to be opened, but
+// not for too long, as there might never be a host to open it
+#ifndef BOOT_SERIAL_MILLIS
+#define BOOT_SERIAL_MILLIS 500
 #endif
-    Serial.begin(115200);
-    packet_start(Serial);
-    Serial.print("sketch=" __FILE__);
-    packet_end(Serial);
 
-    led[0].pin = LED1;
-    led[1].pin = LED2;
+// A PN532 can miss the first command after it is woken up, so one that does
+// not answer at boot is tried this many times before it is taken as not
+// being fitted
+#ifndef BOOT_READER_TRIES
+#define BOOT_READER_TRIES 3
+#endif
 
-    pinMode(led[0].pin, OUTPUT);
-    pinMode(led[1].pin, OUTPUT);
+#ifdef __AVR__
+// Older bootloaders leave the watchdog running after it has reset the chip,
+// which would reset it again before setup() is reached
+void wdt_init(void) __attribute__((naked, used, section(".init3")));
+void wdt_init(void) {
+    MCUSR = 0;
+    wdt_disable();
+}
+#endif
 
-    // Set all status lights on to show we are booting
-    digitalWrite(led[0].pin, HIGH);
-    digitalWrite(led[1].pin, HIGH);
+static void reader_print_version(uint8_t nr) {
+  uint32_t versiondata = health_version(nr);
+  outbuf.print(F("Found chip PN5")); outbuf.println((versiondata>>24) & 0xFF, HEX);
+  outbuf.print(F("Firmware ver. ")); outbuf.print((versiondata>>16) & 0xFF, DEC);
+  outbuf.print('.'); outbuf.println((versiondata>>8) & 0xFF, DEC);
+}
+
+void setup(void) {
+#ifdef __AVR__
+    // Resets the Arduino if the main loop ever stops running
+    wdt_enable(WDTO_2S);
+#endif
 
-  nfc.begin();
+    // Every reader must be deselected before talking to any of them
+    for (uint8_t nr = 0; nr < READERS_MAX; nr++) {
+        pinMode(reader_ss[nr], OUTPUT);
+        digitalWrite(reader_ss[nr], HIGH);
+    }
+
+    // Start all of the readers coming up first, so that they are getting
+    // ready while the rest of the boot carries on
+    for (uint8_t nr = 0; nr < READERS_MAX; nr++) {
+        health_begin(readers[nr], nr);
+    }
 
-  uint32_t versiondata = nfc.getFirmwareVersion();
-  if (! versiondata) {
-    Serial.print("ERROR:no PN53x board found");
-    while (1); // halt
-  }
-  // Got ok data, print it out!
-  Serial.print("Found chip PN5"); Serial.println((versiondata>>24) & 0xFF, HEX);
-  Serial.print("Firmware ver. "); Serial.print((versiondata>>16) & 0xFF, DEC);
-  Serial.print('.'); Serial.println((versiondata>>8) & 0xFF, DEC);
+#ifndef ESP8266
+    while (!Serial && millis() < BOOT_SERIAL_MILLIS); // for Leonardo/Micro/Zero
+#endif
+    Serial.begin(115200);
+    packet_start(outbuf);
+    outbuf.print(F("sketch=" __FILE__));
+    packet_end(outbuf);
 
-  // configure board to read RFID tags
-  nfc.SAMConfig();
+    led_attach(0, LED1);
+    led_attach(1, LED2);
 
-    // Signal PN532 initialized by turning off led1
-    digitalWrite(led[0].pin, LOW);
+    // Set all status lights on to show we are booting
+    digitalWrite(LED1, HIGH);
+    digitalWrite(LED2, HIGH);
+
+    // Wait for every reader to either come up or run out of tries.  One
+    // that does not answer by then is taken as not being fitted.
+    uint8_t tries[READERS_MAX] = {};
+    bool starting;
+    do {
+#ifdef __AVR__
+        // A slow or missing PN532 can keep us here for longer than the
+        // watchdog allows
+        wdt_reset();
+#endif
+        starting = false;
+        for (uint8_t nr = 0; nr < READERS_MAX; nr++) {
+            uint8_t state = health_check(outbuf, readers[nr], nr, false);
+            if (state == HEALTH_DOWN && ++tries[nr] < BOOT_READER_TRIES) {
+                health_begin(readers[nr], nr);
+                state = HEALTH_STARTING;
+            }
+            if (state == HEALTH_STARTING) {
+                starting = true;
+            }
+        }
+    } while (starting);
+
+    packet_readers = 0;
+    for (uint8_t nr = 0; nr < READERS_MAX; nr++) {
+        if (health_up(nr)) {
+            reader_print_version(nr);
+            readers_fitted |= 1 << nr;
+            packet_readers++;
+        }
+    }
+    if (!readers_fitted) {
+        // Rather than halting, keep trying the first reader, which sends
+        // reader=up if it ever answers
+        outbuf.println(F("ERROR:no PN53x board found"));
+        readers_fitted = 1;
+        packet_readers = 1;
+    } else {
+        // Signal PN532 initialized by turning off led1
+        digitalWrite(LED1, LOW);
+    }
 
     // Show the timer and mainloop is ticking by turning off led2 shortly
-    led[1].mode = LED_MODE_ON;
-    led[1].next_state_millis = millis() + 500;
+    led_set(1, LED_MODE_ON, 500);
 
     ledtimer_init();
 
-  Serial.println("Waiting for a Card ...");
+    // The time taken to get to the first poll
+    packet_start(outbuf);
+    outbuf.print(F("boot="));
+    outbuf.print(millis());
+    packet_end(outbuf);
+
+    outbuf.println(F("Waiting for a Card ..."));
+    // The rest goes out while the first poll is running, rather than
+    // holding it up
+    outbuf.drain();
 }
 
-Card last_card;
+void idle_tasks(void) {
+#ifdef __AVR__
+    wdt_reset();
+#endif
 
-void loop(void) {
     while (Serial.available()) {
         handle_serial(Serial.read());
     }
+    unsigned long isr_us;
+    if (ledtimer_isr_time(&isr_us)) {
+        stats_record(STATS_ISR, 0, isr_us);
+    }
+    stats_report(outbuf);
+    outbuf.drain();
+
+    // Keep every PN532 polling for cards.  This also runs while one reader
+    // is busy reading a card, so the others are still looking for cards
+    // and have their results ready by the time they are serviced.
+    for (uint8_t nr = 0; nr < READERS_MAX; nr++) {
+        if ((readers_fitted & (1 << nr)) && health_up(nr) && !readers[nr].busy()) {
+            pn532_autopoll_start(readers[nr]);
+        }
+    }
+}
 
-    uint8_t polldata[64];   // Buffer to store the poll results
-    uint8_t found = nfc.inAutoPoll(polldata, sizeof(polldata));
+// Handle the poll results from one reader, returning false if its poll has
+// not finished yet
+static bool reader_service(uint8_t nr) {
+    PN532& reader = readers[nr];
+
+    // Buffer to store the poll results, always available as it is the first
+    // one taken from the arena
+    Scratch poll(POLLDATA_SIZE);
+    uint8_t *polldata = poll.buf;
+    uint8_t found;
+    if (!pn532_autopoll_done(reader, polldata, POLLDATA_SIZE, &found)) {
+        return false;
+    }
+
+    packet_reader = nr;
 
     if (!found) {
-        if (last_card.uid_type != UID_TYPE_NONE) {
-            // Show that the card reader is clear of detected cards
-            last_card.uid_type = UID_TYPE_NONE;
-            packet_start(Serial);
-            Serial.print(F("uid="));
-            last_card.print_uid(Serial);
-            packet_end(Serial);
-            Serial.println();
-        }
-        return;
+        presence_expire(outbuf, nr);
+        return true;
     }
 
     // we found at least one card, blink the status light for a bit
-    led[0].mode = LED_MODE_BLINK1;
-    led[0].next_state_millis = millis() + 500;
-    led[1].mode = LED_MODE_ON;
-    led[1].next_state_millis = millis() + 3000;
+    led_set(0, LED_MODE_BLINK1, 500);
+    led_set(1, LED_MODE_ON, 3000);
 
     if (output_flags & OUTPUT_RAWALL) {
         // only output message if debugging output is on
-        packet_start(Serial);
-        Serial.print("rawpoll=");
-        hexdump(Serial, polldata, sizeof(polldata));
-        packet_end(Serial);
+        packet_start(outbuf);
+        outbuf.print(F("rawpoll="));
+        hexdump(outbuf, polldata, pn532_autopoll_len(polldata, found, POLLDATA_SIZE));
+        packet_end(outbuf);
     }
 
+    unsigned long detected = millis();
     uint8_t pos = 0;
     while(found) {
         uint8_t type = polldata[pos++];
         uint8_t len = polldata[pos++];
         uint8_t *data = &polldata[pos];
-        uint8_t *ats = NULL;
+        uint8_t plan = 0;
         pos += len;
         found--;
 
@@ -130,15 +274,22 @@ void loop(void) {
         uint8_t tg = data[0];
 
         Card card;
+        card.detected = detected;
 
         switch(type) {
             case TYPE_MIFARE:
             case TYPE_ISO14443A:
-                // uint16_t sens_res = data[1,2];   ATQA
-                // uint8_t sel_res = data[3];       SAK
+                // data[1,2] is the ATQA (sens_res), data[3] the SAK (sel_res)
                 card.set_uid(&data[5], data[4]);
-                if (len > (4 + card.uid_len)) {
-                    ats = &data[5 + card.uid_len];
+                if (len >= 5 + card.uid_len) {
+                    classify_iso14443a(
+                        buf_be2hs(&data[1]),
+                        data[3],
+                        card.uid_len,
+                        &data[5 + card.uid_len],
+                        len - 5 - card.uid_len,
+                        &plan
+                    );
                 }
 
                 if (type == TYPE_MIFARE) {
@@ -152,9 +303,12 @@ void loop(void) {
             case TYPE_FELICA_424:
                 // uint8_t pol_res = data[1] == len(targetdata)
                 // uint8_t response = data[2] == 0x01 (polling RC)
-                // part manufacturing data = data[11..19]
+                // data[3..10] is the IDm and data[11..18] the PMm
                 card.set_uid(&data[3], 8);
                 card.set_uid_type(UID_TYPE_FELICA);
+                if (len >= 19) {
+                    plan = PROBE_FELICA_SERVICES;
+                }
                 break;
             default:
                 // TODO: highlight this better?
@@ -176,66 +330,81 @@ void loop(void) {
         case 0x82: // DEP active 424 kbps.
 */
 
-        if (card == last_card) {
+        if (presence_seen(nr, card) != PRESENCE_ARRIVED) {
             // Skip repeatly processing the same card
-            return;
+            continue;
         }
-        last_card = card;
 
         if (card.uid_type > UID_TYPE_UNKNOWN) {
-
-            packet_start(Serial);
-            Serial.print("uid=");
-            card.print_uid(Serial);
-            packet_end(Serial);
+            card.print_uid_msg(outbuf);
         }
 
         // Always do a raw dump if we didnt understand the data
         if ((card.uid_type <= UID_TYPE_UNKNOWN) || (output_flags & OUTPUT_RAWTAG)) {
-            packet_start(Serial);
-            Serial.print("rawtag=");
-            hexdump(Serial, &type, 1);
-            hexdump(Serial, &len, 1);
-            hexdump(Serial, data, len);
-            packet_end(Serial);
+            if (output_flags & OUTPUT_BINARY) {
+                packet_event(outbuf, EVENT_RAWTAG, type, data, len, detected);
+            } else {
+                packet_start(outbuf);
+                outbuf.print(F("rawtag="));
+                hexdump(outbuf, &type, 1);
+                hexdump(outbuf, &len, 1);
+                hexdump(outbuf, data, len);
+                packet_event_end(outbuf, detected);
+            }
         }
 
-        if (type == TYPE_MIFARE) {
-            decode_mifare(nfc, card);
+        unsigned long decode_start = micros();
+
+        if (plan & PROBE_MIFARE_PAGES) {
+            decode_mifare(reader, tg, card);
+        }
+        if (plan & PROBE_ISO7816) {
+            decode_iso7816(reader, tg);
+        }
+        if (plan & PROBE_DESFIRE_APPS) {
+            decode_iso14443a(reader, tg, card);
+        }
+        if (plan & PROBE_FELICA_SERVICES) {
+            decode_felica(reader, tg, card, &data[11]);
         }
 
-        if (type == TYPE_ISO14443A) {
-            if (ats) {
-                // A combination of the ATS length and first two bytes
-                uint32_t magic = buf_be2h24(ats);
-
-                if (magic == 0x107880) {
-                    // I have three cards that respond with "6700" for DESFire
-                    // commands, which seems matches a 7816 "length error" code
-                    // and they all have this magic
-                    // Once again, I've not seen anything that claims to be a
-                    // document for how to identify them (if only the ISO docs
-                    // were actually free to download)
-                    decode_iso7816(nfc);
-                }
-            }
-            if (card.uid_len != 4) {
-                // I have found nothing clearly documenting this, but some cards
-                // using the ISO14443A discovery protocol dont actually respond
-                // to any of the standard card function requests
-                //
-                // error datapoints:
-                // ATQA=0008, len=4, apps returns 6700
-                // ATQA=0044, len=7, apps returns 6700
-                //
-                // all working samples:
-                // ATQA=0344, len=7, apps returns 00xxxxxx[yyyyyy]
-
-                decode_iso14443a(nfc, tg, card);
-            }
+        stats_record(
+            STATS_DECODE,
+            card.info_type != INFO_TYPE_NONE ? card.info_type : card.uid_type,
+            micros() - decode_start
+        );
+
+        card.print_info_msg(outbuf);
+        card.print_cardid_msg(outbuf);
+        allowlist_decide(card);
+        presence_decoded(nr, card);
+    }
+
+    // A card missing from this poll may have left while another stayed
+    presence_expire(outbuf, nr);
+    return true;
+}
+
+void loop(void) {
+    // Bring back any reader that has stopped working.  This is done here,
+    // rather than in idle_tasks(), so that it never happens part way
+    // through reading a card, and before idle_tasks() can start another
+    // poll on it.
+    for (uint8_t nr = 0; nr < READERS_MAX; nr++) {
+        if (readers_fitted & (1 << nr)) {
+            health_check(outbuf, readers[nr], nr, true);
         }
+    }
+
+    idle_tasks();
 
-        card.print_info_msg(Serial);
-        card.print_cardid_msg(Serial);
+    // Take the readers in turn, so that one with a stream of cards cannot
+    // keep the others waiting
+    for (uint8_t i = 0; i < READERS_MAX; i++) {
+        uint8_t nr = reader_next;
+        reader_next = (nr + 1) % READERS_MAX;
+        if ((readers_fitted & (1 << nr)) && health_up(nr) && reader_service(nr)) {
+            return;
+        }
     }
 }
@@ -32,6 +32,15 @@ uint32_t buf_be2h24(uint8_t *buf) {
     return result;
 }
 
+uint16_t buf_be2hs(uint8_t *buf) {
+    uint16_t result;
+
+    result = buf[0];
+    result <<= 8;
+    result |= buf[1];
+    return result;
+}
+
 uint32_t buf_le2hl(uint8_t *buf) {
     uint32_t result;
 
@@ -10,6 +10,7 @@
 /* Convert from a memory buffer to an integer */
 uint32_t buf_be2hl(uint8_t *buf);
 uint32_t buf_be2h24(uint8_t *buf);
+uint16_t buf_be2hs(uint8_t *buf);
 uint32_t buf_le2hl(uint8_t *buf);
 
 /* Print an int with a zeropadded prefix */
@@ -6,8 +6,8 @@
  */
 
 #include <Print.h>
-#include <stdarg.h>
 
+#include "arduino_cardreader.h"
 #include "card.h"
 #include "hexdump.h"
 #include "packets.h"
@@ -40,11 +40,66 @@ void Card::print_uid(Print& p) {
     hexdump(p, uid, uid_len);
 }
 
-void Card::set_info(const char *format, ...) {
-    va_list ap;
-    va_start(ap, format);
-    vsnprintf(info, sizeof(info), format, ap);
-    va_end(ap);
+void Card::print_uid_msg(Print& p) {
+    if (output_flags & OUTPUT_BINARY) {
+        if (uid_type == UID_TYPE_NONE) {
+            packet_event(p, EVENT_DEPART, 0, NULL, 0, detected);
+        } else {
+            packet_event(p, EVENT_UID, uid_type, uid, uid_len, detected);
+        }
+        return;
+    }
+
+    packet_start(p);
+    p.print(F("uid="));
+    print_uid(p);
+    packet_event_end(p, detected);
+}
+
+void Card::print_departed_msg(Print& p) {
+    if (output_flags & OUTPUT_BINARY) {
+        packet_event(p, EVENT_GONE, uid_type, uid, uid_len, detected);
+        return;
+    }
+
+    packet_start(p);
+    p.print(F("gone="));
+    print_uid(p);
+    packet_event_end(p, detected);
+}
+
+void Card::clear_info(void) {
+    info_len = 0;
+    memset(info, 0, sizeof(info));
+}
+
+void Card::add_info_digit(uint8_t digit) {
+    if (info_len >= CARD_INFO_DIGITS) {
+        return;
+    }
+    if (info_len & 1) {
+        info[info_len / 2] |= digit & 0xf;
+    } else {
+        info[info_len / 2] = digit << 4;
+    }
+    info_len++;
+}
+
+void Card::add_info_number(uint32_t n, uint8_t width) {
+    uint8_t digits[10];
+    uint8_t count = 0;
+    do {
+        digits[count++] = n % 10;
+        n /= 10;
+    } while (n);
+
+    while (width > count) {
+        add_info_digit(0);
+        width--;
+    }
+    while (count) {
+        add_info_digit(digits[--count]);
+    }
 }
 
 void Card::print_info(Print& p) {
@@ -64,13 +119,34 @@ void Card::print_info(Print& p) {
         case INFO_TYPE_SERIAL_CLIPPER:
             p.print(F("clipper"));
             break;
+        case INFO_TYPE_SERIAL_FELICA_LITE:
+            p.print(F("felicalite"));
+            break;
+        case INFO_TYPE_SERIAL_EDY:
+            p.print(F("edy"));
+            break;
+        case INFO_TYPE_SERIAL_NANACO:
+            p.print(F("nanaco"));
+            break;
         default:
             p.print(F("ERROR"));
             return;
     }
 
     p.print('/');
-    p.print(info);
+    for (uint8_t i = 0; i < info_len; i++) {
+        uint8_t digit = info[i / 2];
+        digit = (i & 1) ? (digit & 0xf) : (digit >> 4);
+        p.print((char)(digit < 10 ? '0' + digit : 'a' - 10 + digit));
+    }
+}
+
+// The binary events send the digit count followed by the packed digits
+void Card::print_info_event(Print& p, uint8_t type) {
+    uint8_t buf[1 + sizeof(info)];
+    buf[0] = info_len;
+    memcpy(&buf[1], info, (info_len + 1) / 2);
+    packet_event(p, type, info_type, buf, 1 + (info_len + 1) / 2, detected);
 }
 
 void Card::print_info_msg(Print& p) {
@@ -78,6 +154,11 @@ void Card::print_info_msg(Print& p) {
         return;
     }
 
+    if (output_flags & OUTPUT_BINARY) {
+        print_info_event(p, EVENT_SERIAL);
+        return;
+    }
+
     packet_start(p);
     switch(info_type & 0xf0) {
         case INFO_TYPE_SERIAL:
@@ -89,7 +170,7 @@ void Card::print_info_msg(Print& p) {
     }
     p.print('=');
     print_info(p);
-    packet_end(p);
+    packet_event_end(p, detected);
 }
 
 void Card::print_cardid_msg(Print& p) {
@@ -98,6 +179,15 @@ void Card::print_cardid_msg(Print& p) {
         return;
     }
 
+    if (output_flags & OUTPUT_BINARY) {
+        if (info_type != INFO_TYPE_NONE) {
+            print_info_event(p, EVENT_CARDID);
+        } else {
+            packet_event(p, EVENT_CARDID, uid_type, uid, uid_len, detected);
+        }
+        return;
+    }
+
     packet_start(p);
     p.print(F("cardid="));
 
@@ -108,5 +198,5 @@ void Card::print_cardid_msg(Print& p) {
         print_uid(p);
     }
 
-    packet_end(p);
+    packet_event_end(p, detected);
 }
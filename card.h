@@ -19,6 +19,12 @@
 #define INFO_TYPE_SERIAL_MIKI       0x12
 #define INFO_TYPE_SERIAL_OPAL       0x13
 #define INFO_TYPE_SERIAL_CLIPPER    0x14
+#define INFO_TYPE_SERIAL_FELICA_LITE 0x15
+#define INFO_TYPE_SERIAL_EDY        0x16
+#define INFO_TYPE_SERIAL_NANACO     0x17
+
+// The most digits that a decoded serial number can have
+#define CARD_INFO_DIGITS 20
 
 #include <Print.h>
 
@@ -28,13 +34,15 @@ class Card {
         uint8_t uid_len;    // How many bytes from uid are valid
         uint8_t uid[8];
         uint8_t info_type;
-        char info[21];
+        uint8_t info_len;   // How many digits of info are valid
+        uint8_t info[CARD_INFO_DIGITS / 2];     // Packed BCD, MSD first
+        unsigned long detected;     // The millis() when the card was found
 
         Card(void) {
             uid_type=UID_TYPE_NONE;
             info_type=INFO_TYPE_NONE;
-            // ensure that the info buf is zero-terminated
-            info[0] = 0;
+            info_len = 0;
+            detected = 0;
         };
 
         bool operator == (const Card &a) {
@@ -51,9 +59,20 @@ class Card {
         void set_uid_type(uint8_t type) { uid_type=type; };
         void print_uid(Print& p);
 
-        void set_info(const char *format, ...);
+        // Sends the uid= message (or the departure, for UID_TYPE_NONE)
+        void print_uid_msg(Print& p);
+
+        // Sends the gone= message when this card leaves the reader
+        void print_departed_msg(Print& p);
+
+        // The serial number is built up from the most significant digit.
+        // Digits above 9 are allowed, and are shown as hex
+        void clear_info(void);
+        void add_info_digit(uint8_t digit);
+        void add_info_number(uint32_t n, uint8_t width);    // Zero padded
         void set_info_type(const uint8_t type) { info_type=type; };
         void print_info(Print& p);
+        void print_info_event(Print& p, uint8_t type);
 
         // Called before overwriting info[] to print any previous info
         void print_info_msg(Print& p);
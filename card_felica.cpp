@@ -0,0 +1,149 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * functions to decode FeliCa cards
+ */
+
+#include <Arduino.h>
+
+#include "arduino_cardreader.h"
+#include "card.h"
+#include "card_felica.h"
+#include "hexdump.h"
+#include "idcache.h"
+#include "outbuf.h"
+#include "packets.h"
+#include "pn532.h"
+#include "scratch.h"
+
+#define FELICA_CMD_READ     0x06    // Read Without Encryption
+#define FELICA_RES_READ     0x07
+
+// The most blocks that one entry can read, in a single command
+#define FELICA_BLOCKS_MAX   2
+#define FELICA_BLOCK_SIZE   16
+
+// The response header is the length, the response code, the IDm, two status
+// flags and the block count
+#define FELICA_RES_HDR      13
+
+// The services that we know how to get a serial number from.  The serial is
+// taken as hex digits from the blocks that were read, which is how these
+// numbers are printed on the cards.
+struct felica_service {
+    uint8_t ic_mask;    // Only tried if the PMm IC type matches
+    uint8_t ic_type;
+    uint16_t service;
+    uint8_t block;      // The first block to read
+    uint8_t blocks;     // How many blocks to read
+    uint8_t offset;     // Where the serial starts in the data
+    uint8_t digits;
+    uint8_t info_type;
+};
+
+static const struct felica_service felica_services[] PROGMEM = {
+    // FeliCa Lite and Lite-S: the ID block (0x82) in the read only service
+    // holds the DFC and the issuer's own ID after the card ID
+    {0xfe, 0xf0, 0x000b, 0x82, 1, 8, 16, INFO_TYPE_SERIAL_FELICA_LITE},
+
+    // Edy: the number printed on the card is in the first block
+    {0x00, 0x00, 0x110b, 0, 1, 2, 16, INFO_TYPE_SERIAL_EDY},
+
+    // nanaco
+    {0x00, 0x00, 0x558b, 0, 1, 0, 16, INFO_TYPE_SERIAL_NANACO},
+};
+#define FELICA_SERVICES (sizeof(felica_services) / sizeof(felica_services[0]))
+
+// Read blocks from one service, returning a pointer to the block data (within
+// res) or NULL if the card could not (or would not) answer.  *reslen is left
+// as zero if there was no answer at all
+static uint8_t *felica_read(PN532& nfc, uint8_t tg, Card& card, const struct felica_service *svc, uint8_t *res, uint8_t *reslen) {
+    uint8_t cmd[13 + 2 * FELICA_BLOCKS_MAX];
+    uint8_t len = 0;
+
+    cmd[len++] = 0;     // Length, filled in below
+    cmd[len++] = FELICA_CMD_READ;
+    memcpy(&cmd[len], card.uid, 8);
+    len += 8;
+    cmd[len++] = 1;     // One service
+    cmd[len++] = svc->service & 0xff;
+    cmd[len++] = svc->service >> 8;
+    cmd[len++] = svc->blocks;
+    for (uint8_t i = 0; i < svc->blocks; i++) {
+        cmd[len++] = 0x80;  // Two byte block list element, service 0
+        cmd[len++] = svc->block + i;
+    }
+    cmd[0] = len;
+
+    if (!pn532_exchange(nfc, tg, cmd, len, res, reslen)) {
+        *reslen = 0;
+        return NULL;
+    }
+    if (output_flags & OUTPUT_RAWALL) {
+        packet_start(outbuf);
+        outbuf.print(F("felica="));
+        hexdump(outbuf, res, *reslen);
+        packet_end(outbuf);
+    }
+
+    if (*reslen < FELICA_RES_HDR || res[1] != FELICA_RES_READ) {
+        return NULL;
+    }
+    if (res[10] != 0) {
+        // Status flag 1 is non zero for any error, such as a missing service
+        return NULL;
+    }
+    if (res[12] != svc->blocks || *reslen < FELICA_RES_HDR + svc->blocks * FELICA_BLOCK_SIZE) {
+        return NULL;
+    }
+    return &res[FELICA_RES_HDR];
+}
+
+// Returns false if the card could not be read
+static bool decode_felica_services(PN532& nfc, uint8_t tg, Card& card, uint8_t *pmm) {
+    Scratch res(FELICA_RES_HDR + FELICA_BLOCKS_MAX * FELICA_BLOCK_SIZE);
+    if (!res.buf) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < FELICA_SERVICES; i++) {
+        struct felica_service svc;
+        memcpy_P(&svc, &felica_services[i], sizeof(svc));
+
+        // PMm byte 1 is the IC type
+        if ((pmm[1] & svc.ic_mask) != svc.ic_type) {
+            continue;
+        }
+
+        uint8_t reslen = FELICA_RES_HDR + FELICA_BLOCKS_MAX * FELICA_BLOCK_SIZE;
+        uint8_t *data = felica_read(nfc, tg, card, &svc, res.buf, &reslen);
+        if (!data) {
+            if (!reslen) {
+                // No answer at all, so the card has probably gone
+                return false;
+            }
+            continue;
+        }
+
+        // Flush old info, before overwriting
+        card.print_info_msg(outbuf);
+        card.clear_info();
+        for (uint8_t d = 0; d < svc.digits; d++) {
+            uint8_t byte = data[svc.offset + d / 2];
+            card.add_info_digit((d & 1) ? (byte & 0xf) : (byte >> 4));
+        }
+        card.set_info_type(svc.info_type);
+        return true;
+    }
+    return true;
+}
+
+void decode_felica(PN532& nfc, uint8_t tg, Card& card, uint8_t *pmm) {
+    if (idcache_lookup(card)) {
+        return;
+    }
+    if (decode_felica_services(nfc, tg, card, pmm)) {
+        idcache_store(card);
+    }
+}
@@ -0,0 +1,13 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * functions to decode FeliCa cards
+ */
+#pragma once
+
+#include "card.h"
+#include "pn532.h"
+
+// The pmm is the 8 byte manufacture parameter from the poll
+void decode_felica(PN532& nfc, uint8_t tg, Card& card, uint8_t *pmm);
@@ -10,50 +10,37 @@
 #include "arduino_cardreader.h"
 #include "byteops.h"
 #include "card.h"
+#include "checkdigit.h"
 #include "hexdump.h"
+#include "idcache.h"
+#include "outbuf.h"
 #include "packets.h"
+#include "pn532.h"
+#include "scratch.h"
 
-uint8_t str_luhn(char *s) {
-    uint8_t sum = 0;
-    bool doubling=true;
-    while(*s) {
-        uint8_t digit = *s - 0x30;
-        if (!doubling) {
-            sum += digit;
-        } else if (digit > 4) {
-            sum += 2 * digit -9;
-        } else {
-            sum += 2 * digit;
-        }
-        doubling = !doubling;
-        s++;
-    }
-    // FIXME:
-    // There shouldnt be a +1 here, so there is probably an error somewhere in
-    // my formula above
-    uint8_t check = (10 - (sum % 10)) +1;
-    if (check==10) {
-        check = 0;
-    }
-    return check;
-}
+// Each frame of the app list holds a status byte and up to 19 app IDs.  A
+// DESFire EV1 holds at most 28 apps, which needs two frames, but the later
+// cards can hold more, so up to four frames are read.
+#define ISO14443A_APPS_FRAMES 4
+#define ISO14443A_APPS_FRAME_MAX (1 + 19 * 3)
 
-bool iso14443a_select_app(Adafruit_PN532& nfc, uint8_t tg, uint32_t app) {
+bool iso14443a_select_app(PN532& nfc, uint8_t tg, uint32_t app) {
     uint8_t cmd[4];
     cmd[0] = 0x5a;   // Select Application
     cmd[1] = (app & 0xff0000) >> 16;
     cmd[2] = (app & 0xff00) >> 8;
     cmd[3] = (app & 0xff);
-    uint8_t reslen = sizeof(cmd);
 
-    // FIXME: set private nfc._inListedTag == tg;
-    if (!nfc.inDataExchange(cmd,4,cmd,&reslen)) {
+    uint8_t res[4];
+    uint8_t reslen = sizeof(res);
+
+    if (!pn532_exchange(nfc, tg, cmd,4,res,&reslen)) {
         return false;
     }
     return true;
 }
 
-uint8_t iso14443a_read_file(Adafruit_PN532& nfc, uint8_t tg, uint8_t file, uint8_t offset, uint8_t size, uint8_t *buf, uint8_t buflen) {
+uint8_t iso14443a_read_file(PN532& nfc, uint8_t tg, uint8_t file, uint8_t offset, uint8_t size, uint8_t *buf, uint8_t buflen) {
     uint8_t cmd[8];
     cmd[0] = 0xbd;  // Read Data
     cmd[1] = file;  // File no
@@ -64,124 +51,166 @@ uint8_t iso14443a_read_file(Adafruit_PN532& nfc, uint8_t tg, uint8_t file, uint8
     cmd[6] = 0;
     cmd[7] = 0;     // read size high byte
 
-    // FIXME: set private nfc._inListedTag == tg;
-    if (!nfc.inDataExchange(cmd,8,buf,&buflen)) {
+    if (!pn532_exchange(nfc, tg, cmd,8,buf,&buflen)) {
         return 0;
     }
     return buflen;
 }
 
-static void do_iso14443a_clipper(Adafruit_PN532& nfc, uint8_t tg, Card& card) {
-    if (!iso14443a_select_app(nfc, tg, 0x9011f2)) {
-        return;
-    }
-
-    uint8_t buf[8];
-    if (iso14443a_read_file(nfc, tg,8,1,4,buf,sizeof(buf)) != 5) {
-        return;
-    }
-
-    // Flush old info, before overwriting
-    card.print_info_msg(Serial);
-    card.set_info(
-        "%9lu",
-        buf_be2hl(&buf[1])
-    );
-    card.set_info_type(INFO_TYPE_SERIAL_CLIPPER);
+static void format_clipper(Card& card, uint8_t *data) {
+    card.clear_info();
+    card.add_info_number(buf_be2hl(&data[0]), 9);
 }
 
-static void do_iso14443a_opal(Adafruit_PN532& nfc, uint8_t tg, Card& card) {
-    if (!iso14443a_select_app(nfc, tg, 0x314553)) {
-        return;
-    }
-
-    uint8_t buf[6];
-    if (iso14443a_read_file(nfc, tg,7,0,5,buf,sizeof(buf)) != 6) {
-        return;
-    }
-
-    // Flush old info, before overwriting
-    card.print_info_msg(Serial);
+static void format_opal(Card& card, uint8_t *data) {
     // TODO: what if the uint32 is >999999999 ??
-    card.set_info(
-        "308522%09lu%i",
-        buf_le2hl(&buf[1]),
-        buf[5] & 0xf
-    );
-    card.set_info_type(INFO_TYPE_SERIAL_OPAL);
+    card.clear_info();
+    card.add_info_number(308522, 6);
+    card.add_info_number(buf_le2hl(&data[0]), 9);
+    // Printed in decimal, so 10 to 15 take two digits
+    card.add_info_number(data[4] & 0xf, 1);
 }
 
-static void do_iso14443a_myki(Adafruit_PN532& nfc, uint8_t tg, Card& card) {
-    if (!iso14443a_select_app(nfc, tg, 0x11F2)) {
-        return;
+static void format_myki(Card& card, uint8_t *data) {
+    // TODO:
+    // - what if the second uint32 is >99999999 ??
+    card.clear_info();
+    card.add_info_number(buf_le2hl(&data[0]), 6);
+    card.add_info_number(buf_le2hl(&data[4]), 8);
+    card.add_info_digit(checkdigit_luhn(card.info, card.info_len));
+}
+
+// The DESFire applications that we know how to get a serial number from.
+// When a card has more than one of these, the highest priority one is used.
+struct iso14443a_app {
+    uint32_t aid;
+    uint8_t priority;
+    uint8_t file;
+    uint8_t offset;
+    uint8_t size;
+    uint8_t info_type;
+    void (*format)(Card& card, uint8_t *data);
+};
+
+static const struct iso14443a_app iso14443a_apps[] PROGMEM = {
+    {0x0011f2, 10, 0x0f, 0, 8, INFO_TYPE_SERIAL_MIKI, format_myki},
+    {0x314553, 10, 0x07, 0, 5, INFO_TYPE_SERIAL_OPAL, format_opal},
+    {0x9011f2, 10, 0x08, 1, 4, INFO_TYPE_SERIAL_CLIPPER, format_clipper},
+};
+#define ISO14443A_APPS (sizeof(iso14443a_apps) / sizeof(iso14443a_apps[0]))
+
+// The buffer for a file read: the largest file that any registered app reads
+// (8 bytes, for Myki), plus the status byte
+#define ISO14443A_APP_FILE_MAX (8 + 1)
+
+static bool do_iso14443a_app(PN532& nfc, uint8_t tg, const struct iso14443a_app *app, Card& card) {
+    if (!iso14443a_select_app(nfc, tg, app->aid)) {
+        return false;
     }
 
-    uint8_t buf[10];
-    if (iso14443a_read_file(nfc, tg,0xf,0,8,buf,sizeof(buf)) != 9) {
-        return;
+    Scratch file(ISO14443A_APP_FILE_MAX);
+    uint8_t *buf = file.buf;
+    if (!buf) {
+        return false;
+    }
+    uint8_t len = iso14443a_read_file(nfc, tg, app->file, app->offset, app->size, buf, ISO14443A_APP_FILE_MAX);
+    if (len != app->size + 1) {
+        return false;
     }
 
     // Flush old info, before overwriting
-    card.print_info_msg(Serial);
-    // TODO:
-    // - what if the second uint32 is >99999999 ??
-    card.set_info(
-        "%06lu%08lu",
-        buf_le2hl(&buf[1]),
-        buf_le2hl(&buf[5])
-    );
-    card.info[14] = str_luhn(card.info) + 0x30;
-    card.info[15] = 0;
-    card.set_info_type(INFO_TYPE_SERIAL_MIKI);
+    card.print_info_msg(outbuf);
+    app->format(card, &buf[1]);
+    card.set_info_type(app->info_type);
+    return true;
 }
 
-uint8_t do_iso14443a_apps(Adafruit_PN532& nfc, uint8_t tg, uint8_t *res, uint8_t reslen) {
+// Send Get Application IDs (0x6a), or ask for the next frame of the answer
+// (0xaf) if the previous one said there was more to come
+uint8_t do_iso14443a_apps(PN532& nfc, uint8_t tg, uint8_t code, uint8_t *res, uint8_t reslen) {
     uint8_t cmd[1];
-    cmd[0] = 0x6a;   // Get Application IDs
+    cmd[0] = code;
 
-    // TODO: set private nfc._inListedTag == tg;
-    bool status = nfc.inDataExchange(cmd,1,res,&reslen);
+    bool status = pn532_exchange(nfc, tg, cmd,1,res,&reslen);
     if (!status) {
         return 0;
     }
-
-    // TODO:
-    // We blithely assume that there are no continuation packets for this data
-
     return reslen;
 }
 
-void decode_iso14443a(Adafruit_PN532& nfc, uint8_t tg, Card& card) {
-    uint8_t res[10];
-
-    uint8_t reslen = do_iso14443a_apps(nfc, tg, res, sizeof(res));
-    if (output_flags & OUTPUT_RAWALL) {
-        packet_start(Serial);
-        Serial.print("apps=");
-        hexdump(Serial, res, reslen);
-        packet_end(Serial);
+// Find the best known app on the card, returning ISO14443A_APPS if there is
+// none, or 0xff if the card could not be read
+static uint8_t iso14443a_best_app(PN532& nfc, uint8_t tg) {
+    Scratch frame(ISO14443A_APPS_FRAME_MAX);
+    uint8_t *res = frame.buf;
+    if (!res) {
+        return 0xff;
     }
+    uint8_t code = 0x6a;
+    uint8_t frames = 0;
+
+    // Each app ID is looked up as it arrives, so the full list never needs
+    // to be stored
+    uint8_t best = ISO14443A_APPS;
+    uint8_t best_priority = 0;
+
+    do {
+        uint8_t reslen = do_iso14443a_apps(nfc, tg, code, res, ISO14443A_APPS_FRAME_MAX);
+        if (output_flags & OUTPUT_RAWALL) {
+            packet_start(outbuf);
+            outbuf.print(F("apps="));
+            hexdump(outbuf, res, reslen);
+            packet_end(outbuf);
+        }
+        if (!reslen) {
+            return 0xff;
+        }
 
-    uint8_t pos = 1;
-    while(pos < reslen) {
-        uint32_t app = buf_be2h24(&res[pos]);
-        pos += 3;
-
-        // TODO:
-        // - we return after the first matched app ID, which might not be
-        //   the correct answer.  (So far, only myki has more than one app)
-
-        switch(app) {
-            case 0x11f2:
-                do_iso14443a_myki(nfc, tg, card);
-                return;
-            case 0x314553:
-                do_iso14443a_opal(nfc, tg, card);
-                return;
-            case 0x9011f2:
-                do_iso14443a_clipper(nfc, tg, card);
-                return;
+        for (uint8_t pos = 1; pos + 3 <= reslen; pos += 3) {
+            uint32_t aid = buf_be2h24(&res[pos]);
+
+            for (uint8_t i = 0; i < ISO14443A_APPS; i++) {
+                if (pgm_read_dword(&iso14443a_apps[i].aid) != aid) {
+                    continue;
+                }
+                uint8_t priority = pgm_read_byte(&iso14443a_apps[i].priority);
+                if (best == ISO14443A_APPS || priority > best_priority) {
+                    best = i;
+                    best_priority = priority;
+                }
+                break;
+            }
         }
+
+        // 0xaf is "additional frame"
+        code = 0xaf;
+    } while (res[0] == 0xaf && ++frames < ISO14443A_APPS_FRAMES);
+
+    return best;
+}
+
+// Returns false if the card could not be read
+static bool decode_iso14443a_apps(PN532& nfc, uint8_t tg, Card& card) {
+    uint8_t best = iso14443a_best_app(nfc, tg);
+    if (best == 0xff) {
+        return false;
+    }
+    if (best == ISO14443A_APPS) {
+        // Nothing that we know how to decode
+        return true;
+    }
+
+    struct iso14443a_app app;
+    memcpy_P(&app, &iso14443a_apps[best], sizeof(app));
+    return do_iso14443a_app(nfc, tg, &app, card);
+}
+
+void decode_iso14443a(PN532& nfc, uint8_t tg, Card& card) {
+    if (idcache_lookup(card)) {
+        return;
+    }
+    if (decode_iso14443a_apps(nfc, tg, card)) {
+        idcache_store(card);
     }
 }
 
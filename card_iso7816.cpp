@@ -8,9 +8,14 @@
 #include <Adafruit_PN532.h>
 #include <Arduino.h>
 
+#include "arduino_cardreader.h"
 #include "byteops.h"
 #include "card_iso7816.h"
 #include "hexdump.h"
+#include "outbuf.h"
+#include "packets.h"
+#include "pn532.h"
+#include "scratch.h"
 
 #define APDU_selectByID     0
 #define APDU_selectFile     1
@@ -19,118 +24,215 @@
 #define APDU_getBalance     4
 #define APDU_readBinary     5
 
-static uint8_t * apdu[] = {
-    [APDU_selectByID]   = "\x00\xa4\x00\x00\x00",       // id = Master File?
-    [APDU_selectFile]   = "\x00\xa4\x04\x00\x0e" "1PAY.SYS.DDF01",
-    [APDU_readRecord]   = "\x00\xb2\x01\x14\x00",
-    [APDU_readPSE]      = "\x00\xb2\x01\x02\x00\x00",           // idx = 02
-    [APDU_getBalance]   = "\x80\x5c\x00\x02\x04\x00",
-    [APDU_readBinary]   = "\x00\xb0\x95\x00\x00",               // sfi = 95
-    "\xff\x00\x48\x00\x00",
-    "\xff\x00\x00\x00\x02\xd4\x02",
-    "\x00\xc0\x00\x00\x20",     // get response, le=0x20
+static const uint8_t apdu_selectByID_cmd[] PROGMEM = {0x00, 0xa4, 0x00, 0x00, 0x00};    // id = Master File?
+static const uint8_t apdu_selectFile_cmd[] PROGMEM = {
+    0x00, 0xa4, 0x04, 0x00, 0x0e,
+    '1', 'P', 'A', 'Y', '.', 'S', 'Y', 'S', '.', 'D', 'D', 'F', '0', '1',
 };
-static const uint8_t apdu_size[] = {
-    [APDU_selectByID] = 5,
-    [APDU_selectFile] = 19,
-    [APDU_readRecord] = 5,
-    [APDU_readPSE] = 6,
-    [APDU_getBalance] = 6,
-    [APDU_readBinary] = 5,
-    5,
-    7,
-    5,
+static const uint8_t apdu_readRecord_cmd[] PROGMEM = {0x00, 0xb2, 0x01, 0x14, 0x00};
+static const uint8_t apdu_readPSE_cmd[] PROGMEM = {0x00, 0xb2, 0x01, 0x02, 0x00, 0x00};     // idx = 02
+static const uint8_t apdu_getBalance_cmd[] PROGMEM = {0x80, 0x5c, 0x00, 0x02, 0x04, 0x00};
+static const uint8_t apdu_readBinary_cmd[] PROGMEM = {0x00, 0xb0, 0x95, 0x00, 0x00};        // sfi = 95
+
+static const char apdu_selectByID_name[] PROGMEM = "selectByID";
+static const char apdu_selectFile_name[] PROGMEM = "selectFile";
+static const char apdu_readRecord_name[] PROGMEM = "readRecord";
+static const char apdu_readPSE_name[] PROGMEM = "readPSE";
+static const char apdu_getBalance_name[] PROGMEM = "getBalance";
+static const char apdu_readBinary_name[] PROGMEM = "readBinary";
+
+// Other commands seen in use, which are not sent:
+//  ff 00 48 00 00
+//  ff 00 00 00 02 d4 02
+//  00 c0 00 00 20          get response, le=0x20
+
+struct apdu_def {
+    const uint8_t *cmd;
+    uint8_t size;
+    const char *name;
 };
-static const char *apdu_name[] = {
-    [APDU_selectByID] = "selectByID",
-    [APDU_selectFile] = "selectFile",
-    [APDU_readRecord] = "readRecord",
-    [APDU_readPSE] = "readPSE",
-    [APDU_getBalance] = "getBalance",
-    [APDU_readBinary] = "readBinary",
-    "unk",
-    "unk",
-    "getResponse",
+
+#define APDU(x) {apdu_ ## x ## _cmd, sizeof(apdu_ ## x ## _cmd), apdu_ ## x ## _name}
+
+static const struct apdu_def apdu[] PROGMEM = {
+    APDU(selectByID),
+    APDU(selectFile),
+    APDU(readRecord),
+    APDU(readPSE),
+    APDU(getBalance),
+    APDU(readBinary),
+};
+
+// The largest of the above, and room for an Le byte to be added to it
+#define APDU_CMD_MAX (19 + 1)
+
+// The response buffer, which includes room for the status word
+#define APDU_RES_MAX 34
+
+// How many GET RESPONSE (or resend) rounds a single step may take
+#define APDU_CHAIN_MAX 4
+
+static const char apdu_getResponse_name[] PROGMEM = "getResponse";
+
+/*
+ * A script is a list of steps, each sending one of the APDUs above, with one
+ * of its bytes optionally replaced
+ */
+#define APDU_STOP   1   // End the script unless the status is 9000
+
+struct apdu_step {
+    uint8_t nr;
+    uint8_t pos;    // The byte to replace, or zero for none
+    uint8_t val;
+    uint8_t flags;
 };
 
+// Most payment cards reject the SELECT of the master file, so it is only the
+// PPSE select that decides whether the rest is worth sending
+static const struct apdu_step iso7816_script[] PROGMEM = {
+    {APDU_selectByID, 0, 0, 0},
+    {APDU_selectFile, 0, 0, APDU_STOP},
+    {APDU_readBinary, 2, 0x80 | 21, 0},
+    {APDU_readPSE, 3, 2, 0},
+    {APDU_getBalance, 0, 0, 0},
+};
+#define ISO7816_SCRIPT_STEPS (sizeof(iso7816_script) / sizeof(iso7816_script[0]))
 
-static serial_reserror(uint8_t * err) {
-    switch(err[0]) {
+// Describe the status words that we know, or NULL
+static const __FlashStringHelper *apdu_error(uint8_t sw1, uint8_t sw2) {
+    switch(sw1) {
         case 0x67:
-            Serial.print(F("Length Incorrect"));
-            return;
+            return F("Length Incorrect");
         case 0x69:
-            Serial.print(F("Not Allowed"));
-            // err[1] == 81, "imcompatible with file structure"
-            return;
+            // sw2 == 81, "imcompatible with file structure"
+            return F("Not Allowed");
         case 0x6a:
-            Serial.print(F("Wrong Param: "));
-            switch(err[1]) {
-                case 0x82:
-                    Serial.print(F("File not found"));
-                    return;
+            if (sw2 == 0x82) {
+                return F("Wrong Param: File not found");
             }
-            return;
+            return F("Wrong Param");
         case 0x6d:
-            Serial.print(F("ISN not supported"));
-            return;
+            return F("ISN not supported");
     }
+    return NULL;
 }
 
-static uint8_t apdu_send(Adafruit_PN532& nfc, char *name, uint8_t *cmd, uint8_t cmdlen, uint8_t *res, uint8_t reslen) {
-    Serial.println(name);
-    Serial.print(F("APDU Tx: "));
-    hexdump(Serial, cmd,cmdlen);
-    Serial.println();
-
-    // FIXME: set private nfc._inListedTag == tg;
-    if (!nfc.inDataExchange(cmd,cmdlen,res,&reslen)) {
-        return 0;
+// Send the apdu= debug message for one exchange
+static void apdu_trace(const char *name, uint8_t *cmd, uint8_t cmdlen, uint8_t *res, uint8_t reslen) {
+    packet_start(outbuf);
+    outbuf.print(F("apdu="));
+    outbuf.print((const __FlashStringHelper *)name);
+    outbuf.print(',');
+    hexdump(outbuf, cmd, cmdlen);
+    outbuf.print(',');
+    hexdump(outbuf, res, reslen);
+    if (reslen == 2 && apdu_error(res[0], res[1])) {
+        outbuf.print(',');
+        outbuf.print(apdu_error(res[0], res[1]));
     }
+    packet_end(outbuf);
+}
 
-    Serial.print(F("APDU Rx: "));
-    hexdump(Serial, res,reslen);
-    if (reslen == 2) {
-        Serial.print(' ');
-        serial_reserror(res);
+// Whether the APDU ends with an Le byte, which is case 2 or case 4
+static bool apdu_has_le(const uint8_t *cmd, uint8_t cmdlen) {
+    if (cmdlen < 5) {
+        return false;
+    }
+    if (cmdlen == 5) {
+        return true;
     }
-    Serial.println();
-    return reslen;
+    return cmdlen > 5 + cmd[4];
 }
 
-static void apdu_simple(Adafruit_PN532& nfc, uint8_t nr) {
-    uint8_t *cmd = apdu[nr];
-    uint8_t cmdlen = apdu_size[nr];
-
-    uint8_t buf[32];
-    apdu_send(nfc, apdu_name[nr], apdu[nr], apdu_size[nr], buf, sizeof(buf));
-}
+// Send an APDU, following a 61xx status with GET RESPONSE and a 6Cxx status
+// with a resend using the length that the card asked for.  Returns the final
+// status word, or zero if the exchange failed.  The response data from all
+// of the rounds is left in res, with its length (without the status word) in
+// *reslen.  The cmd buffer must have room for one more byte, in case an Le
+// has to be added to it
+static uint16_t apdu_exchange(PN532& nfc, uint8_t tg, const char *name, uint8_t *cmd, uint8_t cmdlen, uint8_t *res, uint8_t *reslen) {
+    uint8_t get_response[5] = {0x00, 0xc0, 0x00, 0x00, 0x00};
+    uint8_t size = *reslen;
+    uint8_t have = 0;
+    bool resent = false;
+
+    for (uint8_t round = 0; round < APDU_CHAIN_MAX; round++) {
+        uint8_t len = size - have;
+        bool ok = pn532_exchange(nfc, tg, cmd, cmdlen, &res[have], &len);
+        if (output_flags & OUTPUT_APDU) {
+            apdu_trace(name, cmd, cmdlen, &res[have], ok ? len : 0);
+        }
+        if (!ok || len < 2) {
+            return 0;
+        }
+
+        uint8_t sw1 = res[have + len - 2];
+        uint8_t sw2 = res[have + len - 1];
+
+        if (sw1 == 0x6c && !resent) {
+            // Wrong Le, and the card said what it should be.  This is only
+            // tried once, so a card that keeps asking cannot use up the rounds
+            if (apdu_has_le(cmd, cmdlen)) {
+                cmd[cmdlen - 1] = sw2;
+            } else {
+                cmd[cmdlen++] = sw2;
+            }
+            resent = true;
+            continue;
+        }
+
+        have += len - 2;
+        if (sw1 == 0x61) {
+            // More data is waiting, so ask for as much as will fit
+            uint8_t space = size - have - 2;
+            if (space == 0) {
+                break;
+            }
+            get_response[4] = (sw2 && sw2 < space) ? sw2 : space;
+            cmd = get_response;
+            cmdlen = sizeof(get_response);
+            name = apdu_getResponse_name;
+            continue;
+        }
+
+        *reslen = have;
+        return (sw1 << 8) | sw2;
+    }
 
-static void selectByID(Adafruit_PN532& nfc) {
-    apdu_simple(nfc, APDU_selectByID);
+    *reslen = have;
+    return 0;
 }
 
-static void getBalance(Adafruit_PN532& nfc) {
-    apdu_simple(nfc, APDU_getBalance);
-}
+static uint16_t apdu_step(PN532& nfc, uint8_t tg, const struct apdu_step *step) {
+    struct apdu_def def;
+    memcpy_P(&def, &apdu[step->nr], sizeof(def));
 
-static void readPSE(Adafruit_PN532& nfc, uint8_t index) {
-    apdu[APDU_readPSE][3] = index;
-    apdu_simple(nfc, APDU_readPSE);
-}
+    Scratch cmd(APDU_CMD_MAX);
+    Scratch res(APDU_RES_MAX);
+    if (!cmd.buf || !res.buf) {
+        return 0;
+    }
+    memcpy_P(cmd.buf, def.cmd, def.size);
+    if (step->pos) {
+        cmd.buf[step->pos] = step->val;
+    }
 
-static void readBinary(Adafruit_PN532& nfc, uint8_t sfi) {
-    apdu[APDU_readBinary][2] = sfi;
-    apdu_simple(nfc, APDU_readBinary);
+    uint8_t reslen = APDU_RES_MAX;
+    return apdu_exchange(nfc, tg, def.name, cmd.buf, def.size, res.buf, &reslen);
 }
 
-void decode_iso7816(Adafruit_PN532& nfc) {
-
-    selectByID(nfc);
-    apdu_simple(nfc, APDU_selectFile);
-    readBinary(nfc,0x80 | 21);
+void decode_iso7816(PN532& nfc, uint8_t tg) {
+    for (uint8_t i = 0; i < ISO7816_SCRIPT_STEPS; i++) {
+        struct apdu_step step;
+        memcpy_P(&step, &iso7816_script[i], sizeof(step));
 
-    readPSE(nfc,2);
-    getBalance(nfc);
+        uint16_t sw = apdu_step(nfc, tg, &step);
+        if (!sw) {
+            // The card has gone, or never spoke 7816
+            return;
+        }
+        if ((step.flags & APDU_STOP) && sw != 0x9000) {
+            return;
+        }
+    }
 }
-
@@ -6,5 +6,5 @@
  */
 #pragma once
 
-#include <Adafruit_PN532.h>
-void decode_iso7816(Adafruit_PN532& nfc);
+#include "pn532.h"
+void decode_iso7816(PN532& nfc, uint8_t tg);
@@ -12,75 +12,196 @@
 #include "byteops.h"
 #include "card.h"
 #include "hexdump.h"
+#include "idcache.h"
+#include "outbuf.h"
 #include "packets.h"
+#include "pn532.h"
+#include "scratch.h"
 
-uint8_t mifare_read(Adafruit_PN532& nfc, uint8_t page, uint8_t * buf, uint8_t buflen) {
+// Not all of the Ultralight family support this, see mifare_read_pages()
+#define MIFARE_CMD_FAST_READ 0x3a
+
+// How many 4 byte pages of an Ultralight style card can be kept
+#define MIFARE_PAGES 8
+
+// Pages already read from the card, so that each decoder does not need to
+// read them again.  The buffer is borrowed from the scratch arena for as long
+// as the card is being decoded.
+struct mifare_pages {
+    uint8_t first;
+    uint8_t count;
+    uint8_t *buf;       // MIFARE_PAGES * 4 bytes
+};
+
+// Returns the cached contents of a page, or NULL if it was not read
+static uint8_t *mifare_page(struct mifare_pages *pages, uint8_t nr) {
+    if (nr < pages->first || nr - pages->first >= pages->count) {
+        return NULL;
+    }
+    return &pages->buf[(nr - pages->first) * 4];
+}
+
+uint8_t mifare_read(PN532& nfc, uint8_t tg, uint8_t page, uint8_t * buf, uint8_t buflen) {
     uint8_t cmd[2];
     cmd[0] = MIFARE_CMD_READ;
     cmd[1] = page;
 
-    // FIXME: set private nfc._inListedTag == tg;
-    if (!nfc.inDataExchange(cmd,2,buf,&buflen)) {
+    if (!pn532_exchange(nfc, tg, cmd,2,buf,&buflen)) {
+        return 0;
+    }
+    return buflen;
+}
+
+uint8_t mifare_fast_read(PN532& nfc, uint8_t tg, uint8_t first, uint8_t last, uint8_t * buf, uint8_t buflen) {
+    uint8_t cmd[3];
+    cmd[0] = MIFARE_CMD_FAST_READ;
+    cmd[1] = first;
+    cmd[2] = last;
+
+    if (!pn532_exchange(nfc, tg, cmd,3,buf,&buflen)) {
         return 0;
     }
     return buflen;
 }
 
-static void decode_hsl(Adafruit_PN532& nfc, Card& card, uint8_t *page4) {
+// Fill the card page cache with at least the pages first to last, in one
+// exchange.  A READ always returns four pages and works on every card in the
+// family, so FAST_READ is only used when more than that is needed (it is
+// missing from the original Ultralight, which would halt on it)
+static bool mifare_read_pages(PN532& nfc, uint8_t tg, struct mifare_pages *pages, uint8_t first, uint8_t last) {
+    if (mifare_page(pages, first) && mifare_page(pages, last)) {
+        return true;
+    }
+
+    uint8_t count = last - first + 1;
+    if (last < first || count > MIFARE_PAGES) {
+        return false;
+    }
+
+    if (count <= 4) {
+        count = 4;
+        if (mifare_read(nfc, tg, first, pages->buf, count * 4) != count * 4) {
+            return false;
+        }
+    } else {
+        if (mifare_fast_read(nfc, tg, first, last, pages->buf, count * 4) != count * 4) {
+            return false;
+        }
+    }
+
+    pages->first = first;
+    pages->count = count;
+
+    if (output_flags & OUTPUT_RAWALL) {
+        packet_start(outbuf);
+        outbuf.print(F("page["));
+        outbuf.print(first);
+        outbuf.print(F(".."));
+        outbuf.print(first + count - 1);
+        outbuf.print(F("]="));
+        hexdump(outbuf, pages->buf, count * 4);
+        packet_end(outbuf);
+    }
+    return true;
+}
+
+static bool decode_hsl(Card& card, struct mifare_pages *pages) {
+    uint8_t *page4 = mifare_page(pages, 4);
+    if (buf_be2h24(&page4[1]) != 0x924621) {
+        return false;
+    }
+
     uint32_t u1 = buf_be2h24(&card.uid[1]);
     uint32_t u2 = buf_be2h24(&card.uid[4]);
 
     // Flush old info, before overwriting
-    card.print_info_msg(Serial);
-    card.set_info(
-        "%02x%02x%02x%02x%02x%07lu%x",
-        page4[1],page4[2],page4[3],page4[4],page4[5],
-        (u1^u2)&0x7fffff,
-        (page4[6]>>4)
-    );
+    card.print_info_msg(outbuf);
+    card.clear_info();
+    for (uint8_t i = 1; i <= 5; i++) {
+        card.add_info_digit(page4[i] >> 4);
+        card.add_info_digit(page4[i] & 0xf);
+    }
+    card.add_info_number((u1^u2)&0x7fffff, 7);
+    card.add_info_digit(page4[6]>>4);
     card.set_info_type(INFO_TYPE_SERIAL_HSL);
+    return true;
 }
 
-static void decode_troika(Adafruit_PN532& nfc, Card& card, uint8_t *page4) {
+static bool decode_troika(Card& card, struct mifare_pages *pages) {
+    uint8_t *page4 = mifare_page(pages, 4);
+    if ((page4[0] != 0x45) || ((page4[1] & 0xc0) != 0xc0)) {
+        return false;
+    }
+
     // Flush old info, before overwriting
-    card.print_info_msg(Serial);
-    card.set_info(
-        "%lu",
-        (buf_be2hl(&page4[0]) << 20) | (buf_be2hl(&page4[4]) >> 12)
+    card.print_info_msg(outbuf);
+    card.clear_info();
+    card.add_info_number(
+        (buf_be2hl(&page4[0]) << 20) | (buf_be2hl(&page4[4]) >> 12),
+        1
     );
     card.set_info_type(INFO_TYPE_SERIAL_TROIKA);
+    return true;
 }
 
-static void decode_mifare7(Adafruit_PN532& nfc, Card& card) {
-    // TODO: update Card class to cache read pages
-    uint8_t page4[16];
+// The decoders for 7 byte UID cards, tried in order.  Each one says which
+// pages it looks at, and all of those pages are read before any are tried.
+struct mifare7_decoder {
+    uint8_t first;
+    uint8_t last;
+    // Returns true if it knew the card
+    bool (*decode)(Card& card, struct mifare_pages *pages);
+};
 
-    if (mifare_read(nfc, 4, page4, sizeof(page4))!=sizeof(page4)) {
-        return;
-    }
+static const struct mifare7_decoder mifare7_decoders[] PROGMEM = {
+    {4, 7, decode_hsl},
+    {4, 7, decode_troika},
+};
+#define MIFARE7_DECODERS (sizeof(mifare7_decoders) / sizeof(mifare7_decoders[0]))
 
-    if (output_flags & OUTPUT_RAWALL) {
-        packet_start(Serial);
-        Serial.print("page[4..7]=");
-        hexdump(Serial, page4, sizeof(page4));
-        packet_end(Serial);
+// Returns false if the card could not be read
+static bool decode_mifare7(PN532& nfc, uint8_t tg, Card& card) {
+    uint8_t first = 0xff;
+    uint8_t last = 0;
+    for (uint8_t i = 0; i < MIFARE7_DECODERS; i++) {
+        uint8_t f = pgm_read_byte(&mifare7_decoders[i].first);
+        uint8_t l = pgm_read_byte(&mifare7_decoders[i].last);
+        if (f < first) {
+            first = f;
+        }
+        if (l > last) {
+            last = l;
+        }
     }
 
-    if (buf_be2h24(&page4[1]) == 0x924621) {
-        decode_hsl(nfc, card, page4);
-        return;
+    Scratch buf(MIFARE_PAGES * 4);
+    if (!buf.buf) {
+        return false;
     }
+    struct mifare_pages pages = {0, 0, buf.buf};
 
-    if ((page4[0]==0x45) && (page4[1]&0xc0 == 0xc0)) {
-        decode_troika(nfc, card, page4);
-        return;
+    if (!mifare_read_pages(nfc, tg, &pages, first, last)) {
+        return false;
     }
 
+    for (uint8_t i = 0; i < MIFARE7_DECODERS; i++) {
+        struct mifare7_decoder decoder;
+        memcpy_P(&decoder, &mifare7_decoders[i], sizeof(decoder));
+        if (decoder.decode(card, &pages)) {
+            break;
+        }
+    }
+    return true;
 }
 
-void decode_mifare(Adafruit_PN532& nfc, Card& card) {
+void decode_mifare(PN532& nfc, uint8_t tg, Card& card) {
     if (card.uid_len == 7) {
-        decode_mifare7(nfc, card);
+        if (idcache_lookup(card)) {
+            return;
+        }
+        if (decode_mifare7(nfc, tg, card)) {
+            idcache_store(card);
+        }
         return;
     }
 }
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Check digit algorithms for the serial numbers printed on cards.
+ * It is intended to be generic enough to be reusable in other projects
+ */
+
+#include "checkdigit.h"
+
+uint8_t checkdigit_luhn(const uint8_t *bcd, uint8_t count) {
+    uint8_t sum = 0;
+
+    // Counting from the right, every second digit is doubled, starting with
+    // the digit that will sit next to the check digit
+    bool doubling = true;
+    while (count--) {
+        uint8_t digit = bcd[count / 2];
+        digit = (count & 1) ? (digit & 0xf) : (digit >> 4);
+
+        if (doubling) {
+            digit *= 2;
+            if (digit > 9) {
+                digit -= 9;
+            }
+        }
+        sum += digit;
+        doubling = !doubling;
+    }
+    return (10 - (sum % 10)) % 10;
+}
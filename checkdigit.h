@@ -0,0 +1,14 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Check digit algorithms for the serial numbers printed on cards.
+ * It is intended to be generic enough to be reusable in other projects
+ */
+#pragma once
+
+#include <stdint.h>
+
+// Returns the Luhn (mod 10) check digit for the first count digits of the
+// packed BCD buffer, most significant digit first
+uint8_t checkdigit_luhn(const uint8_t *bcd, uint8_t count);
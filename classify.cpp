@@ -0,0 +1,113 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Decide what kind of card an ISO14443A target is, from the data returned
+ * by the poll, so that only the reads that can work on it are tried.
+ */
+
+#include <Arduino.h>
+#include "byteops.h"
+#include "classify.h"
+
+#define ANY_ATQA    0
+#define ANY_SAK     0xff
+#define ANY_LEN     0
+#define ANY_ATS     0
+#define ANY_HIST    0
+
+struct classify_rule {
+    uint16_t atqa;
+    uint8_t sak;
+    uint8_t uid_len;
+    uint32_t ats;       // The ATS length, T0 and TA bytes
+    uint8_t hist;       // The first ATS historical byte
+    uint8_t family;
+    uint8_t plan;
+};
+
+// The first matching rule is used, and a card matching none of them is not
+// probed at all.
+//
+// I have found nothing clearly documenting this, but some cards using the
+// ISO14443A discovery protocol dont actually respond to any of the standard
+// card function requests.  Error datapoints, which answer the DESFire Get
+// Application IDs with "6700":
+// ATQA=0008, len=4
+// ATQA=0044, len=7
+//
+// All working DESFire samples have ATQA=0344, len=7, but it is the SAK and
+// the DESFire historical byte in the ATS that mark them out, so any ATQA
+// and UID length (including a random 4 byte UID) are accepted.
+static const struct classify_rule classify_rules[] PROGMEM = {
+    {0x0044, 0x00, 7, ANY_ATS, ANY_HIST, CARD_FAMILY_ULTRALIGHT, PROBE_MIFARE_PAGES},
+    {ANY_ATQA, 0x08, ANY_LEN, ANY_ATS, ANY_HIST, CARD_FAMILY_CLASSIC_1K, 0},
+    {ANY_ATQA, 0x18, ANY_LEN, ANY_ATS, ANY_HIST, CARD_FAMILY_CLASSIC_4K, 0},
+
+    // I have three cards that respond with "6700" for DESFire commands, which
+    // seems matches a 7816 "length error" code and they all have this magic.
+    // I've not seen anything that claims to be a document for how to
+    // identify them (if only the ISO docs were actually free to download)
+    {ANY_ATQA, ANY_SAK, ANY_LEN, 0x107880, ANY_HIST, CARD_FAMILY_ISO7816, PROBE_ISO7816},
+
+    {ANY_ATQA, 0x20, ANY_LEN, ANY_ATS, 0x80, CARD_FAMILY_DESFIRE, PROBE_DESFIRE_APPS},
+};
+#define CLASSIFY_RULES (sizeof(classify_rules) / sizeof(classify_rules[0]))
+
+// Find the first historical byte, skipping over the interface bytes that
+// T0 says are present
+static uint8_t ats_hist(uint8_t *ats, uint8_t atslen) {
+    if (!atslen) {
+        return ANY_HIST;
+    }
+    uint8_t tl = ats[0];
+    if (tl > atslen) {
+        tl = atslen;
+    }
+    if (tl < 2) {
+        return ANY_HIST;
+    }
+
+    uint8_t t0 = ats[1];
+    uint8_t pos = 2;
+    for (uint8_t bit = 0x10; bit <= 0x40; bit <<= 1) {
+        if (t0 & bit) {
+            pos++;
+        }
+    }
+    if (pos >= tl) {
+        return ANY_HIST;
+    }
+    return ats[pos];
+}
+
+uint8_t classify_iso14443a(uint16_t atqa, uint8_t sak, uint8_t uid_len, uint8_t *ats, uint8_t atslen, uint8_t *plan) {
+    uint32_t magic = atslen >= 3 ? buf_be2h24(ats) : ANY_ATS;
+    uint8_t hist = ats_hist(ats, atslen);
+
+    for (uint8_t i = 0; i < CLASSIFY_RULES; i++) {
+        struct classify_rule rule;
+        memcpy_P(&rule, &classify_rules[i], sizeof(rule));
+
+        if (rule.atqa != ANY_ATQA && rule.atqa != atqa) {
+            continue;
+        }
+        if (rule.sak != ANY_SAK && rule.sak != sak) {
+            continue;
+        }
+        if (rule.uid_len != ANY_LEN && rule.uid_len != uid_len) {
+            continue;
+        }
+        if (rule.ats != ANY_ATS && rule.ats != magic) {
+            continue;
+        }
+        if (rule.hist != ANY_HIST && rule.hist != hist) {
+            continue;
+        }
+        *plan = rule.plan;
+        return rule.family;
+    }
+
+    *plan = 0;
+    return CARD_FAMILY_UNKNOWN;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Decide what kind of card an ISO14443A target is, from the data returned
+ * by the poll, so that only the reads that can work on it are tried.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define CARD_FAMILY_UNKNOWN     0
+#define CARD_FAMILY_ULTRALIGHT  1
+#define CARD_FAMILY_CLASSIC_1K  2
+#define CARD_FAMILY_CLASSIC_4K  3
+#define CARD_FAMILY_DESFIRE     4   // EV1 and later, which share an ATS
+#define CARD_FAMILY_ISO7816     5   // Payment style cards
+
+// The probe plan is a set of these
+#define PROBE_MIFARE_PAGES      1   // decode_mifare()
+#define PROBE_DESFIRE_APPS      2   // decode_iso14443a()
+#define PROBE_ISO7816           4   // decode_iso7816()
+#define PROBE_FELICA_SERVICES   8   // decode_felica()
+
+// Returns the card family, and the probes to try in *plan
+uint8_t classify_iso14443a(uint16_t atqa, uint8_t sak, uint8_t uid_len, uint8_t *ats, uint8_t atslen, uint8_t *plan);
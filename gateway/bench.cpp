@@ -0,0 +1,219 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Throughput and latency benchmark for the reader gateway.
+ *
+ * Each reader is stood in for by a pseudo-terminal, with the gateway
+ * running on the slave side just as it would on a USB serial port.  Every
+ * simulated reader taps a card over and over: it sends some unframed text
+ * and the uid=, serial= and cardid= messages, then waits for the LED
+ * command frame to come back before tapping again.  We report the events
+ * handled per second and the time from sending cardid= to receiving the
+ * whole reply.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gateway.h"
+#include "pty.h"
+
+using Clock = std::chrono::steady_clock;
+
+// How many of each reader's taps can be on the allowlist
+#define BENCH_ALLOW_TAPS 2000
+
+struct Reader {
+    int fd;
+    char path[PTY_PATH_MAX];
+    uint32_t taps;
+    Clock::time_point sent;
+    bool waiting;
+    bool in_frame;
+    std::string reply;
+};
+
+static void tap(Reader *r, uint32_t nr) {
+    char buf[256];
+    uint32_t serial = nr * 100000 + r->taps;
+    int len = snprintf(buf, sizeof(buf),
+        "Waiting for a Card ...\r\n"
+        "\x02uid=mifare/04%06X2A6480\x04\r\n"
+        "\x02serial=hsl/92462100%010u\x04\r\n"
+        "\x02" "cardid=hsl/92462100%010u\x04\r\n",
+        serial & 0xffffff, serial, serial
+    );
+    r->sent = Clock::now();
+    r->waiting = true;
+    r->taps++;
+    if (write(r->fd, buf, len) != len) {
+        fprintf(stderr, "%s: short write\n", r->path);
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  -p, --ports N          simulated readers (default 128)\n"
+        "  -w, --workers N        gateway decision workers (default 4)\n"
+        "  -d, --duration SECS    how long to run for (default 2)\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"ports",       required_argument, NULL, 'p'},
+        {"workers",     required_argument, NULL, 'w'},
+        {"duration",    required_argument, NULL, 'd'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    uint32_t nports = 128;
+    double duration = 2;
+    GatewayOptions options;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:w:d:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                nports = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                options.workers = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                duration = strtod(optarg, NULL);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // Two descriptors for each port, plus a few
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < nports * 2 + 64) {
+        rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, nports * 2 + 64);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    std::vector<Reader> readers(nports);
+    Gateway gw(options);
+    for (uint32_t nr = 0; nr < nports; nr++) {
+        Reader *r = &readers[nr];
+        r->fd = pty_open(r->path, sizeof(r->path));
+        if (r->fd == -1 || !gw.add_port(r->path)) {
+            perror("pty");
+            return 1;
+        }
+    }
+
+    // Every odd tap is a card on the allowlist
+    for (uint32_t nr = 0; nr < nports; nr++) {
+        for (uint32_t i = 1; i < BENCH_ALLOW_TAPS; i += 2) {
+            char key[40];
+            snprintf(key, sizeof(key), "hsl/92462100%010u", nr * 100000 + i);
+            gw.allow(key);
+        }
+    }
+
+    std::thread gateway([&gw] { gw.run(); });
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (uint32_t nr = 0; nr < nports; nr++) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = nr;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, readers[nr].fd, &ev);
+    }
+
+    std::vector<uint32_t> latency_us;
+    uint64_t allows = 0;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(duration)
+    );
+    for (uint32_t nr = 0; nr < nports; nr++) {
+        tap(&readers[nr], nr);
+    }
+
+    struct epoll_event evs[64];
+    while (Clock::now() < end) {
+        int n = epoll_wait(epoll_fd, evs, 64, 100);
+        for (int i = 0; i < n; i++) {
+            uint32_t nr = evs[i].data.u32;
+            Reader *r = &readers[nr];
+            char buf[256];
+            ssize_t len;
+            while ((len = read(r->fd, buf, sizeof(buf))) > 0) {
+                for (ssize_t j = 0; j < len; j++) {
+                    if (buf[j] == '\x02') {
+                        r->in_frame = true;
+                        r->reply.clear();
+                    } else if (buf[j] == '\x04' && r->in_frame) {
+                        r->in_frame = false;
+                        if (!r->waiting) {
+                            continue;
+                        }
+                        auto took = Clock::now() - r->sent;
+                        latency_us.push_back(
+                            std::chrono::duration_cast<std::chrono::microseconds>(took).count()
+                        );
+                        if (r->reply == GATEWAY_ALLOW_CMD) {
+                            allows++;
+                        }
+                        r->waiting = false;
+                        tap(r, nr);
+                    } else if (r->in_frame) {
+                        r->reply += buf[j];
+                    }
+                }
+            }
+        }
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    gw.stop();
+    gateway.join();
+    GatewayStats s = gw.stats();
+
+    std::sort(latency_us.begin(), latency_us.end());
+    size_t taps = latency_us.size();
+    auto pct = [&](double p) -> double {
+        if (!taps) {
+            return 0;
+        }
+        return latency_us[std::min(taps - 1, (size_t)(taps * p))] / 1000.0;
+    };
+
+    printf("%5s %7s %8s %10s %10s %8s %8s %8s %8s %6s\n",
+        "ports", "workers", "taps", "taps/s", "events/s",
+        "p50_ms", "p99_ms", "max_ms", "allowed", "lost"
+    );
+    printf("%5u %7u %8zu %10.0f %10.0f %8.3f %8.3f %8.3f %8llu %6llu\n",
+        nports, options.workers, taps, taps / secs, s.events / secs,
+        pct(0.50), pct(0.99), pct(1.0),
+        (unsigned long long)allows,
+        (unsigned long long)(s.queue_full + s.out_full)
+    );
+
+    if (s.dropped_bytes == 0 || s.decisions < taps) {
+        fprintf(stderr, "unexpected gateway stats\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A read-only, memory mapped card database
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "carddb.h"
+
+// 64 bit FNV-1a, with a final mix so that the top bits (used for the radix
+// table) depend on every byte of the key
+uint64_t carddb_hash(const char *key, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (len--) {
+        h ^= (uint8_t)*key++;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+CardDb::~CardDb() {
+    if (map) {
+        munmap(map, map_len);
+    }
+}
+
+// Take len bytes from the *left bytes of the file, returning false if there
+// are not that many
+static bool take(uint64_t *left, uint64_t len) {
+    if (len > *left) {
+        return false;
+    }
+    *left -= len;
+    return true;
+}
+
+CardDb *CardDb::open(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = NULL;
+    if ((size_t)st.st_size >= sizeof(carddb_header)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    close(fd);
+    if (!map || map == MAP_FAILED) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    CardDb *db = new CardDb;
+    db->map = map;
+    db->map_len = st.st_size;
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+
+    // Check that everything the header promises is really in the file.  Each
+    // section is taken from the bytes left after the ones before it, so that
+    // crafted sizes cannot wrap around and add up to the file size.
+    const carddb_header *hdr = (const carddb_header *)map;
+    uint64_t left = st.st_size - sizeof(*hdr);
+    uint64_t radix_len = 0;
+    bool ok = memcmp(hdr->magic, CARDDB_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == CARDDB_VERSION &&
+        hdr->radix_bits >= 1 && hdr->radix_bits <= 28;
+    if (ok) {
+        radix_len = ((1ULL << hdr->radix_bits) + 1) * sizeof(uint32_t);
+        ok = take(&left, radix_len);
+    }
+    if (ok) {
+        ok = hdr->count <= UINT32_MAX && hdr->count <= left / sizeof(carddb_record) &&
+            take(&left, hdr->count * sizeof(carddb_record));
+    }
+    if (ok) {
+        ok = hdr->pool_size == left;
+    }
+    if (!ok) {
+        delete db;
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // And that the radix table cannot send a lookup outside the records
+    const uint32_t *radix = (const uint32_t *)(hdr + 1);
+    uint32_t slots = 1U << hdr->radix_bits;
+    bool sane = radix[0] == 0 && radix[slots] == hdr->count;
+    for (uint32_t b = 0; sane && b < slots; b++) {
+        sane = radix[b] <= radix[b + 1];
+    }
+    if (!sane) {
+        delete db;
+        errno = EINVAL;
+        return NULL;
+    }
+
+    db->hdr = hdr;
+    db->radix = radix;
+    db->records = (const carddb_record *)((const char *)db->radix + radix_len);
+    db->pool = (const char *)(db->records + hdr->count);
+    db->shift = 64 - hdr->radix_bits;
+    return db;
+}
+
+bool CardDb::lookup(const char *key, size_t len, uint16_t *value) const {
+    uint64_t h = carddb_hash(key, len);
+    uint64_t b = h >> shift;
+    uint32_t end = radix[b + 1];
+
+    for (uint32_t i = radix[b]; i < end; i++) {
+        const carddb_record *r = &records[i];
+        if (r->hash < h) {
+            continue;
+        }
+        if (r->hash > h) {
+            break;
+        }
+        if (r->key_len == len && r->key_off + len <= hdr->pool_size &&
+            memcmp(&pool[r->key_off], key, len) == 0) {
+            *value = r->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool carddb_write(const char *path, std::vector<std::pair<std::string, uint16_t>> &entries) {
+    // Sort by hash, keeping the input order for the same key, so that the
+    // last entry for each key can be kept
+    std::vector<carddb_record> records;
+    records.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        const std::string &key = entries[i].first;
+        if (key.size() > UINT16_MAX) {
+            errno = EINVAL;
+            return false;
+        }
+        carddb_record r;
+        r.hash = carddb_hash(key.data(), key.size());
+        r.key_off = i;      // For now, the entry number
+        r.key_len = key.size();
+        r.value = entries[i].second;
+        records.push_back(r);
+    }
+    std::stable_sort(records.begin(), records.end(),
+        [](const carddb_record &a, const carddb_record &b) { return a.hash < b.hash; }
+    );
+
+    std::string pool;
+    std::vector<carddb_record> out;
+    out.reserve(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        const std::string &key = entries[records[i].key_off].first;
+
+        // Any later entry with the same key replaces this one
+        bool replaced = false;
+        for (size_t j = i + 1; j < records.size() && records[j].hash == records[i].hash; j++) {
+            if (entries[records[j].key_off].first == key) {
+                replaced = true;
+                break;
+            }
+        }
+        if (replaced) {
+            continue;
+        }
+
+        carddb_record r = records[i];
+        r.key_off = pool.size();
+        pool += key;
+        out.push_back(r);
+    }
+    if (out.size() > UINT32_MAX || pool.size() > UINT32_MAX) {
+        errno = EFBIG;
+        return false;
+    }
+
+    // Aim for about one record for each radix slot
+    carddb_header hdr = {};
+    memcpy(hdr.magic, CARDDB_MAGIC, sizeof(hdr.magic));
+    hdr.version = CARDDB_VERSION;
+    hdr.radix_bits = 8;
+    while (hdr.radix_bits < 24 && (1ULL << hdr.radix_bits) < out.size()) {
+        hdr.radix_bits++;
+    }
+    hdr.count = out.size();
+    hdr.pool_size = pool.size();
+
+    std::vector<uint32_t> radix((1ULL << hdr.radix_bits) + 1);
+    unsigned shift = 64 - hdr.radix_bits;
+    size_t i = 0;
+    for (uint64_t b = 0; b < radix.size(); b++) {
+        while (i < out.size() && (out[i].hash >> shift) < b) {
+            i++;
+        }
+        radix[b] = i;
+    }
+
+    std::string tmp = std::string(path) + ".tmp" + std::to_string(getpid());
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+        fwrite(radix.data(), sizeof(uint32_t), radix.size(), f) == radix.size() &&
+        fwrite(out.data(), sizeof(carddb_record), out.size(), f) == out.size() &&
+        fwrite(pool.data(), 1, pool.size(), f) == pool.size() &&
+        fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path) == -1) {
+        int saved = errno;
+        unlink(tmp.c_str());
+        errno = saved;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A read-only card database, keyed on the exact cardid= value that the
+ * readers send (eg "opal/3085221234567892" or "mifare/E2E2F98B").
+ *
+ * The file is built ahead of time by carddb_build and then memory mapped,
+ * so a lookup is only a hash, an index into the radix table and a short
+ * scan of fixed-width records - with no system calls and no allocation.
+ *
+ * The layout is:
+ *
+ *      header
+ *      u32 radix[(1 << radix_bits) + 1]   first record for each hash prefix
+ *      carddb_record records[count]       sorted by hash
+ *      char pool[pool_size]               the key strings
+ *
+ * all in the host byte order.  A new file is always written beside the old
+ * one and renamed over it, so a reader has either the old or the new one
+ * mapped, and never a partly written file.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+#define CARDDB_MAGIC    "CARDDB1"
+#define CARDDB_VERSION  1
+
+// The value bits
+#define CARDDB_ALLOW    1
+
+struct carddb_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t radix_bits;
+    uint64_t count;
+    uint64_t pool_size;
+};
+
+struct carddb_record {
+    uint64_t hash;
+    uint32_t key_off;       // Within the pool
+    uint16_t key_len;
+    uint16_t value;
+};
+
+uint64_t carddb_hash(const char *key, size_t len);
+
+class CardDb {
+    public:
+        ~CardDb();
+
+        // Map a database file, returning NULL (with errno set) on failure
+        static CardDb *open(const char *path);
+
+        // Returns false if the key is not in the database
+        bool lookup(const char *key, size_t len, uint16_t *value) const;
+
+        uint64_t size(void) const { return hdr->count; }
+
+        // Which file this is, to spot when it has been replaced
+        dev_t dev;
+        ino_t ino;
+
+    private:
+        CardDb() {}
+
+        void *map = NULL;
+        size_t map_len = 0;
+        const carddb_header *hdr;
+        const uint32_t *radix;
+        const carddb_record *records;
+        const char *pool;
+        unsigned shift;
+};
+
+// Write a new database, replacing any old one at the path.  Later entries
+// win over earlier ones with the same key.  Returns false (with errno set)
+// on failure.
+bool carddb_write(const char *path, std::vector<std::pair<std::string, uint16_t>> &entries);
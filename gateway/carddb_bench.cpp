@@ -0,0 +1,167 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Lookup benchmark for the card database.
+ *
+ * A database of made up cards (in the same mix of families as the readers
+ * send) is built and mapped, and then looked up in a random order - half
+ * with cards that are in the database and half with ones that are not.
+ * Each lookup is timed on its own, for the percentiles, and the whole run
+ * gives the throughput.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "carddb.h"
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t rng_state = 1;
+
+static uint64_t rng(void) {
+    // xorshift64*, repeatable between runs
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static std::string make_card(void) {
+    char buf[40];
+    uint64_t r = rng();
+    switch (r % 4) {
+        case 0:
+            snprintf(buf, sizeof(buf), "mifare/%08X", (unsigned)(r >> 32));
+            break;
+        case 1:
+            snprintf(buf, sizeof(buf), "iso14443a/04%012llX",
+                (unsigned long long)(r >> 16) & 0xffffffffffffULL);
+            break;
+        case 2:
+            snprintf(buf, sizeof(buf), "opal/308522%09llu",
+                (unsigned long long)(r >> 8) % 1000000000ULL);
+            break;
+        default:
+            snprintf(buf, sizeof(buf), "miki/308425%09llu",
+                (unsigned long long)(r >> 8) % 1000000000ULL);
+            break;
+    }
+    return buf;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  -n, --cards N          cards in the database (default 3000000)\n"
+        "  -l, --lookups N        lookups to time (default 2000000)\n"
+        "  -o, --output FILE      where to build the database\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"cards",       required_argument, NULL, 'n'},
+        {"lookups",     required_argument, NULL, 'l'},
+        {"output",      required_argument, NULL, 'o'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    size_t cards = 3000000;
+    size_t lookups = 2000000;
+    const char *output = "build-gateway/bench.carddb";
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:l:o:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                cards = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                lookups = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<std::pair<std::string, uint16_t>> entries;
+    entries.reserve(cards);
+    for (size_t i = 0; i < cards; i++) {
+        entries.emplace_back(make_card(), CARDDB_ALLOW);
+    }
+
+    auto t0 = Clock::now();
+    if (!carddb_write(output, entries)) {
+        perror(output);
+        return 1;
+    }
+    auto t1 = Clock::now();
+    CardDb *db = CardDb::open(output);
+    if (!db) {
+        perror(output);
+        return 1;
+    }
+    auto t2 = Clock::now();
+
+    // Half hits and half (almost certainly) misses, in a random order
+    std::vector<std::string> keys;
+    keys.reserve(lookups);
+    for (size_t i = 0; i < lookups; i++) {
+        if (i & 1) {
+            keys.push_back(make_card());
+        } else {
+            keys.push_back(entries[rng() % cards].first);
+        }
+    }
+
+    std::vector<uint32_t> took_ns(lookups);
+    size_t found = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+        auto a = Clock::now();
+        uint16_t value;
+        found += db->lookup(keys[i].data(), keys[i].size(), &value);
+        auto b = Clock::now();
+        took_ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::sort(took_ns.begin(), took_ns.end());
+    auto pct = [&](double p) -> uint32_t {
+        return took_ns[std::min(lookups - 1, (size_t)(lookups * p))];
+    };
+
+    struct stat st;
+    stat(output, &st);
+
+    printf("%8s %8s %9s %9s %9s %10s %7s %7s %7s %8s\n",
+        "cards", "file_mb", "build_ms", "open_ms", "found",
+        "lookups/s", "p50_ns", "p99_ns", "max_ns", "ns/op"
+    );
+    printf("%8llu %8.1f %9.1f %9.2f %9zu %10.0f %7u %7u %7u %8.1f\n",
+        (unsigned long long)db->size(), st.st_size / 1048576.0,
+        std::chrono::duration<double, std::milli>(t1 - t0).count(),
+        std::chrono::duration<double, std::milli>(t2 - t1).count(),
+        found, lookups / secs,
+        pct(0.50), pct(0.99), pct(1.0),
+        secs * 1e9 / lookups
+    );
+
+    delete db;
+    // Every other lookup was for a card in the database
+    return found >= lookups / 2 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Build a card database file (see carddb.h) from a text list of cards.
+ *
+ * Each line is a cardid= value, optionally followed by whitespace and a
+ * number for the value (default 1, which allows the card).  Blank lines
+ * and lines starting with '#' are skipped.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "carddb.h"
+
+static bool read_list(FILE *f, const char *name, std::vector<std::pair<std::string, uint16_t>> &entries) {
+    char line[256];
+    unsigned nr = 0;
+    while (fgets(line, sizeof(line), f)) {
+        nr++;
+        char *key = line + strspn(line, " \t");
+        if (*key == '#' || *key == '\n' || *key == '\r' || !*key) {
+            continue;
+        }
+        size_t len = strcspn(key, " \t\r\n");
+        char *rest = key + len;
+        unsigned long value = CARDDB_ALLOW;
+        rest += strspn(rest, " \t");
+        if (*rest && *rest != '\r' && *rest != '\n') {
+            char *end;
+            value = strtoul(rest, &end, 0);
+            if (end == rest || value > UINT16_MAX) {
+                fprintf(stderr, "%s:%u: bad value\n", name, nr);
+                return false;
+            }
+        }
+        entries.emplace_back(std::string(key, len), value);
+    }
+    return true;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s -o database [list...]\n"
+        "\n"
+        "Reads the card lists (or stdin), and atomically replaces the database\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!output) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, uint16_t>> entries;
+    if (optind == argc) {
+        if (!read_list(stdin, "stdin", entries)) {
+            return 1;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        FILE *f = fopen(argv[i], "r");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        bool ok = read_list(f, argv[i], entries);
+        fclose(f);
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    if (!carddb_write(output, entries)) {
+        perror(output);
+        return 1;
+    }
+
+    CardDb *db = CardDb::open(output);
+    if (!db) {
+        perror(output);
+        return 1;
+    }
+    fprintf(stderr, "%s: %llu cards\n", output, (unsigned long long)db->size());
+    delete db;
+    return 0;
+}
@@ -0,0 +1,1042 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A fleet of simulated readers, for load testing host software.
+ *
+ * Each reader is a pseudo-terminal whose slave side the host software opens
+ * just as it would a USB serial port.  Opening it "resets" the reader (as
+ * the DTR line does on a real Arduino), which then sends the boot banner and
+ * starts tapping cards, with the same framed messages that the sketch sends.
+ * When the host closes the port, the reader goes quiet until it is opened
+ * again.
+ *
+ * The cards arrive at a configurable rate, with either fixed, uniform or
+ * exponential (Poisson) gaps between them, and optionally in bursts of
+ * several taps in quick succession.  Unframed debug text can be mixed in,
+ * and the host can turn on the rawpoll= and rawtag= messages and sequence
+ * numbers with the same commands as for a real reader.  Alternatively, a
+ * recorded serial log can be replayed on every port, at any speed.
+ *
+ * The command frames from the host are answered as the sketch would answer
+ * them (see handle_serial_cmd()), for the LED, output and status commands.
+ * Commands for features that the fleet does not simulate (the allowlist,
+ * binary output, tracing and so on) are refused.  The time from sending
+ * each cardid= to getting the first frame back from the host is reported.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <queue>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+#include "arduino_cardreader.h"
+#include "ledtimer.h"
+#include "numparse.h"
+#include "packets.h"
+#include "pty.h"
+
+using Clock = std::chrono::steady_clock;
+
+#define FLEET_BOOT_MS       500     // From the port being opened to the banner
+#define FLEET_READY_MS      5       // The boot= time, as a one reader board sends
+#define FLEET_POLL_MS       100     // Between rawpoll= messages for a card
+#define FLEET_CHECK_MS      100     // Between looking for closed ports opening
+#define FLEET_REPLAY_PAUSE_MS 1000  // Between the end of a replay and the start
+
+enum Dist {
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_POISSON,
+};
+
+struct FleetOptions {
+    uint32_t readers = 16;
+    const char *link = NULL;
+    double rate = 0.5;          // Taps per second for each reader
+    Dist dist = DIST_POISSON;
+    uint32_t burst = 1;
+    uint32_t burst_ms = 1500;
+    uint32_t dwell_ms = 800;
+    double noise = 0.1;
+    uint8_t flags = 0;
+    double speed = 1;
+    double duration = 0;
+};
+
+struct FleetCard {
+    uint8_t poll_type;              // The InAutoPoll type, for rawtag=
+    std::vector<uint8_t> target;    // The target data, for rawtag=
+    std::string uid;                // eg "mifare/E2E2F98B"
+    std::string serial;             // eg "opal/3085220093141592", or empty
+
+    const std::string &cardid(void) const {
+        return serial.empty() ? uid : serial;
+    }
+};
+
+struct ReplayLine {
+    uint64_t ms;
+    std::string text;
+    bool cardid;
+};
+
+enum ReaderState {
+    READER_DOWN,
+    READER_BOOTING,
+    READER_IDLE,
+    READER_PRESENT,
+};
+
+struct Reader {
+    int fd;
+    char path[PTY_PATH_MAX];
+    ReaderState state;
+    Clock::time_point due;
+    Clock::time_point boot;
+    uint8_t flags;                  // As output_flags in the sketch
+    uint16_t seq;
+    uint16_t holdoff;
+
+    Clock::time_point group;        // When the current burst started
+    uint32_t burst_left;
+    Clock::time_point depart;
+    const FleetCard *card;
+    uint32_t arrived;
+
+    size_t replay_pos;
+    Clock::time_point replay_base;
+
+    uint8_t cmd[PACKET_CMD_MAX];
+    uint8_t cmdpos;
+
+    bool waiting;
+    Clock::time_point sent;
+};
+
+struct FleetStats {
+    uint64_t boots;
+    uint64_t taps;
+    uint64_t bytes;
+    uint64_t overrun;       // Bytes the host was not reading fast enough for
+    uint64_t frames;
+    uint64_t naks;
+    std::vector<uint32_t> latency_us;
+};
+
+static FleetOptions options;
+static FleetStats stats;
+static std::vector<FleetCard> cards;
+static std::vector<ReplayLine> replay;
+static volatile sig_atomic_t stopping;
+
+static uint64_t rng_state = 1;
+
+static uint64_t rng(void) {
+    // xorshift64*, repeatable between runs
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+// A number in [0, 1)
+static double rng_unit(void) {
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static Clock::duration millis(double ms) {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(ms)
+    );
+}
+
+static void hex(std::string &out, const uint8_t *buf, size_t len) {
+    static const char hexchars[] = "0123456789ABCDEF";
+    while (len--) {
+        out += hexchars[*buf >> 4];
+        out += hexchars[*buf & 0xf];
+        buf++;
+    }
+}
+
+static bool unhex(std::vector<uint8_t> &out, const char *s, size_t len) {
+    if (len & 1) {
+        return false;
+    }
+    out.clear();
+    for (size_t i = 0; i < len; i += 2) {
+        char pair[3] = {s[i], s[i + 1], 0};
+        char *end;
+        out.push_back(strtoul(pair, &end, 16));
+        if (*end) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fill in the target data that InAutoPoll would give for the card
+static void card_target(FleetCard &card, uint8_t type, const std::vector<uint8_t> &uid) {
+    static const uint8_t ats[] = {0x06, 0x75, 0x77, 0x81, 0x02, 0x80};
+    static const uint8_t pmm[] = {0x01, 0x20, 0x22, 0x04, 0x27, 0x67, 0x4d, 0xff};
+
+    card.poll_type = type;
+    card.target.assign(1, 0x01);        // tg
+    switch (type) {
+        case TYPE_MIFARE:
+            card.target.insert(card.target.end(), {0x00, 0x04, 0x08});
+            card.target.push_back(uid.size());
+            card.target.insert(card.target.end(), uid.begin(), uid.end());
+            break;
+        case TYPE_ISO14443A:
+            card.target.insert(card.target.end(), {0x03, 0x44, 0x20});
+            card.target.push_back(uid.size());
+            card.target.insert(card.target.end(), uid.begin(), uid.end());
+            card.target.insert(card.target.end(), ats, ats + sizeof(ats));
+            break;
+        case TYPE_FELICA_212:
+            card.target.insert(card.target.end(), {0x12, 0x01});
+            card.target.insert(card.target.end(), uid.begin(), uid.end());
+            card.target.insert(card.target.end(), pmm, pmm + sizeof(pmm));
+            break;
+    }
+}
+
+static std::vector<uint8_t> random_uid7(void) {
+    uint64_t r = rng();
+    std::vector<uint8_t> uid(1, 0x04);
+    for (int i = 0; i < 6; i++) {
+        uid.push_back(r >> (i * 8));
+    }
+    return uid;
+}
+
+// Make a card from a cardid= value.  A card known by its UID is polled as
+// that type of card, and any other is a transit card with a random UID.
+static bool card_from_key(FleetCard &card, const char *key, size_t len) {
+    static const struct {
+        const char *prefix;
+        uint8_t type;
+        size_t min;
+        size_t max;
+    } uid_types[] = {
+        {"mifare/", TYPE_MIFARE, 4, 7},
+        {"iso14443a/", TYPE_ISO14443A, 4, 10},
+        {"felica/", TYPE_FELICA_212, 8, 8},
+    };
+
+    std::string s(key, len);
+    for (const auto &t : uid_types) {
+        size_t plen = strlen(t.prefix);
+        if (s.compare(0, plen, t.prefix) != 0) {
+            continue;
+        }
+        std::vector<uint8_t> uid;
+        if (!unhex(uid, s.data() + plen, s.size() - plen) ||
+            uid.size() < t.min || uid.size() > t.max) {
+            return false;
+        }
+        card.uid = s;
+        card.serial.clear();
+        card_target(card, t.type, uid);
+        return true;
+    }
+    if (s.find('/') == std::string::npos) {
+        return false;
+    }
+
+    std::vector<uint8_t> uid = random_uid7();
+    card.uid = "iso14443a/";
+    hex(card.uid, uid.data(), uid.size());
+    card.serial = s;
+    card_target(card, TYPE_ISO14443A, uid);
+    return true;
+}
+
+// The same mix of families as in the carddb benchmark
+static void make_cards(size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        char buf[40];
+        uint64_t r = rng();
+        switch (r % 4) {
+            case 0:
+                snprintf(buf, sizeof(buf), "mifare/%08X", (unsigned)(r >> 32));
+                break;
+            case 1:
+                snprintf(buf, sizeof(buf), "iso14443a/04%012llX",
+                    (unsigned long long)(r >> 16) & 0xffffffffffffULL);
+                break;
+            case 2:
+                snprintf(buf, sizeof(buf), "opal/308522%010llu",
+                    (unsigned long long)(r >> 8) % 10000000000ULL);
+                break;
+            default:
+                snprintf(buf, sizeof(buf), "miki/308425%010llu",
+                    (unsigned long long)(r >> 8) % 10000000000ULL);
+                break;
+        }
+        FleetCard card;
+        card_from_key(card, buf, strlen(buf));
+        cards.push_back(card);
+    }
+}
+
+// One cardid= value per line, as for carddb_build
+static bool load_cards(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        return false;
+    }
+    char line[256];
+    unsigned nr = 0;
+    while (fgets(line, sizeof(line), f)) {
+        nr++;
+        char *key = line + strspn(line, " \t");
+        size_t len = strcspn(key, " \t\r\n");
+        if (!len || *key == '#') {
+            continue;
+        }
+        FleetCard card;
+        if (!card_from_key(card, key, len)) {
+            fprintf(stderr, "%s:%u: not a card id\n", filename, nr);
+            fclose(f);
+            errno = EINVAL;
+            return false;
+        }
+        cards.push_back(card);
+    }
+    fclose(f);
+    return !cards.empty();
+}
+
+// Load a serial log for replay.  The time of each line comes from a leading
+// "[seconds]" (as added by grabserial and similar tools), or else from the
+// t= of a card event (when the log was recorded with sequence numbers on).
+// Any other line is sent along with the one before it.
+static bool load_replay(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        return false;
+    }
+
+    uint64_t ms = 0;
+    uint64_t last_t = 0;
+    uint64_t offset = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char *text = line;
+        text[strcspn(text, "\r\n")] = 0;
+
+        if (text[0] == '[') {
+            char *end;
+            double secs = strtod(text + 1, &end);
+            if (end != text + 1 && *end == ']') {
+                ms = secs * 1000;
+                text = end + 1;
+                if (*text == ' ') {
+                    text++;
+                }
+            }
+        } else if (char *t = strstr(text, ",t=")) {
+            // The reader's clock restarts when it does, so carry on from
+            // where it was
+            uint64_t when = strtoull(t + 3, NULL, 10);
+            if (when < last_t) {
+                offset += last_t - when;
+            }
+            last_t = when;
+            ms = std::max(ms, when + offset);
+        }
+
+        ReplayLine r;
+        r.ms = ms;
+        r.text = std::string(text) + "\r\n";
+        r.cardid = strstr(text, "\x02" "cardid=") != NULL;
+        replay.push_back(r);
+    }
+    fclose(f);
+
+    if (replay.empty()) {
+        errno = EINVAL;
+        return false;
+    }
+    uint64_t first = replay[0].ms;
+    for (auto &r : replay) {
+        r.ms -= first;
+    }
+    return true;
+}
+
+static uint32_t reader_millis(Reader *r, Clock::time_point when) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(when - r->boot).count();
+}
+
+static void send(Reader *r, const std::string &out) {
+    if (out.empty()) {
+        return;
+    }
+    ssize_t n = write(r->fd, out.data(), out.size());
+    if (n < 0) {
+        n = 0;
+    }
+    stats.bytes += n;
+    stats.overrun += out.size() - n;
+}
+
+// The end of a card event message, as packet_event_end() sends it
+static void event_end(Reader *r, std::string &out, Clock::time_point when) {
+    if (r->flags & OUTPUT_SEQ) {
+        out += ",seq=" + std::to_string(r->seq++);
+        out += ",t=" + std::to_string(reader_millis(r, when));
+    }
+    out += "\x04\r\n";
+}
+
+static void rawpoll(Reader *r, std::string &out) {
+    const FleetCard *c = r->card;
+    uint8_t head[2] = {c->poll_type, (uint8_t)c->target.size()};
+    out += "\x02rawpoll=";
+    hex(out, head, 2);
+    hex(out, c->target.data(), c->target.size());
+    out += "\x04\r\n";
+}
+
+static void noise(std::string &out) {
+    static const char *const lines[] = {
+        "Sending :  0x00 0x00 0xFF 0x05 0xFB 0xD4 0x60 0xFF 0x01 0x10 0xBC 0x00",
+        "Reading:  0x00 0x00 0xFF 0x00 0xFF 0x00",
+        "Timed out waiting for ACK",
+        "Waiting for a Card ...",
+    };
+    if (rng_unit() < options.noise) {
+        out += lines[rng() % (sizeof(lines) / sizeof(lines[0]))];
+        out += "\r\n";
+    }
+}
+
+static Clock::duration next_gap(void) {
+    if (options.rate <= 0) {
+        return Clock::duration::zero();
+    }
+    double mean = 1000.0 * options.burst / options.rate;
+    switch (options.dist) {
+        case DIST_FIXED:
+            return millis(mean);
+        case DIST_UNIFORM:
+            return millis(rng_unit() * 2 * mean);
+        default:
+            return millis(-log(1 - rng_unit()) * mean);
+    }
+}
+
+static void tap(Reader *r, Clock::time_point now) {
+    r->card = &cards[rng() % cards.size()];
+    r->arrived = reader_millis(r, now);
+    r->depart = now + millis(options.dwell_ms);
+    r->state = READER_PRESENT;
+    stats.taps++;
+
+    const FleetCard *c = r->card;
+    std::string out;
+    noise(out);
+    if (r->flags & OUTPUT_RAWALL) {
+        rawpoll(r, out);
+    }
+    out += "\x02uid=" + c->uid;
+    event_end(r, out, now);
+    if (r->flags & OUTPUT_RAWTAG) {
+        uint8_t head[2] = {c->poll_type, (uint8_t)c->target.size()};
+        out += "\x02rawtag=";
+        hex(out, head, 2);
+        hex(out, c->target.data(), c->target.size());
+        event_end(r, out, now);
+    }
+    if (!c->serial.empty()) {
+        out += "\x02serial=" + c->serial;
+        event_end(r, out, now);
+    }
+    out += "\x02" "cardid=" + c->cardid();
+    event_end(r, out, now);
+
+    r->waiting = true;
+    r->sent = Clock::now();
+    send(r, out);
+}
+
+static void depart(Reader *r, Clock::time_point now) {
+    std::string out;
+    out += "\x02gone=" + r->card->uid;
+    if (r->flags & OUTPUT_SEQ) {
+        out += ",seq=" + std::to_string(r->seq++);
+        out += ",t=" + std::to_string(r->arrived);
+    }
+    out += "\x04\r\n";
+    out += "\x02uid=NONE";
+    event_end(r, out, now);
+    out += "\r\n";
+    send(r, out);
+
+    r->state = READER_IDLE;
+    if (r->burst_left) {
+        r->burst_left--;
+        r->due = now + millis(options.burst_ms);
+        return;
+    }
+    r->burst_left = options.burst - 1;
+    r->group += next_gap();
+    r->due = std::max(r->group, now);
+    r->group = r->due;
+}
+
+static void boot(Reader *r, Clock::time_point now) {
+    r->boot = now;
+    r->flags = options.flags;
+    r->seq = 0;
+    r->holdoff = 500;
+    r->waiting = false;
+    r->state = READER_IDLE;
+    stats.boots++;
+
+    if (!replay.empty()) {
+        r->replay_pos = 0;
+        r->replay_base = now + millis(rng_unit() * 1000);
+        r->due = r->replay_base;
+        return;
+    }
+
+    send(r,
+        "\x02sketch=arduino_cardreader/arduino_cardreader.ino\x04\r\n"
+        "Found chip PN532\r\n"
+        "Firmware ver. 1.6\r\n"
+        "\x02" "boot=" + std::to_string(FLEET_READY_MS) + "\x04\r\n"
+        "Waiting for a Card ...\r\n"
+    );
+    r->burst_left = options.burst - 1;
+    r->group = now + next_gap();
+    r->due = r->group;
+}
+
+// Send every replay line that is due, and return when the next one is
+static void replay_due(Reader *r, Clock::time_point now) {
+    std::string out;
+    while (true) {
+        const ReplayLine &line = replay[r->replay_pos];
+        Clock::time_point when = r->replay_base + millis(line.ms / options.speed);
+        if (when > now) {
+            r->due = when;
+            break;
+        }
+        out += line.text;
+        if (line.cardid) {
+            r->waiting = true;
+            r->sent = Clock::now();
+            stats.taps++;
+        }
+        if (++r->replay_pos == replay.size()) {
+            // Go round again, after a pause
+            r->replay_pos = 0;
+            r->replay_base += millis((replay.back().ms + FLEET_REPLAY_PAUSE_MS) / options.speed);
+        }
+    }
+    send(r, out);
+}
+
+static void reader_due(Reader *r, Clock::time_point now) {
+    switch (r->state) {
+        case READER_BOOTING:
+            boot(r, now);
+            break;
+        case READER_IDLE:
+            if (!replay.empty()) {
+                replay_due(r, now);
+            } else {
+                tap(r, now);
+                r->due = r->depart;
+            }
+            break;
+        case READER_PRESENT:
+            if (now >= r->depart) {
+                depart(r, now);
+                break;
+            }
+            if (r->flags & OUTPUT_RAWALL) {
+                std::string out;
+                rawpoll(r, out);
+                send(r, out);
+            }
+            break;
+        default:
+            return;
+    }
+
+    if (r->state == READER_PRESENT) {
+        r->due = r->depart;
+        if (r->flags & OUTPUT_RAWALL) {
+            r->due = std::min(r->due, now + millis(FLEET_POLL_MS));
+        }
+    }
+}
+
+// The LED commands only need checking, as cmd_led() and cmd_pattern() do,
+// since there are no LEDs to set
+static bool check_led(const uint8_t *buf, uint8_t len) {
+    uint16_t args[4] = {};
+    uint8_t nr = parse_args(args, 4, buf, len);
+    if (nr < 2 || nr == 0xff) {
+        return false;
+    }
+    return args[0] < LEDTIMER_CHANNELS && args[1] < LED_MODES && args[3] <= 0xff;
+}
+
+static bool check_pattern(const uint8_t *buf, uint8_t len) {
+    uint8_t n = 0;
+    while (n < len && buf[n] != ',') {
+        n++;
+    }
+    uint16_t mode;
+    std::vector<uint8_t> pattern;
+    if (!parse_u16(&mode, buf, n) || n == len || mode >= LED_MODES) {
+        return false;
+    }
+    if (mode == LED_MODE_OFF || mode == LED_MODE_BLINK1 ||
+        mode == LED_MODE_BLINK2 || mode == LED_MODE_ON) {
+        return false;
+    }
+    return unhex(pattern, (const char *)&buf[n + 1], len - n - 1) && pattern.size() == 4;
+}
+
+// Carry out one command, returning false if it was not understood or is for
+// something that the fleet does not simulate
+static bool fleet_cmd(Reader *r, std::string &out, const uint8_t *cmd, uint8_t len) {
+    uint16_t val;
+
+    if (len > 1) {
+        switch (cmd[0]) {
+            case 'h':
+                if (!parse_u16(&r->holdoff, &cmd[1], len - 1)) {
+                    return false;
+                }
+                out += "\x02holdoff=" + std::to_string(r->holdoff) + "\x04\r\n";
+                return true;
+            case 'L':
+                return check_led(&cmd[1], len - 1);
+            case 'P':
+                return check_pattern(&cmd[1], len - 1);
+            case 'O':
+                if (!parse_u16(&val, &cmd[1], len - 1) || val > 0xff) {
+                    return false;
+                }
+                r->flags = val;
+                return true;
+        }
+        return false;
+    }
+    if (len != 1) {
+        return false;
+    }
+
+    switch (cmd[0]) {
+        case 'H':
+            out += "Hello\r\n";
+            return true;
+        case '0': case '1': case '2': case '3':
+        case '4': case '5': case '6': case '7':
+            return true;
+        case 'r':
+            r->flags |= OUTPUT_RAWALL;
+            return true;
+        case 'R':
+            r->flags &= ~OUTPUT_RAWALL;
+            return true;
+        case 't':
+            r->flags |= OUTPUT_RAWTAG;
+            return true;
+        case 'T':
+            r->flags &= ~OUTPUT_RAWTAG;
+            return true;
+        case 'q':
+            r->flags |= OUTPUT_SEQ;
+            return true;
+        case 'Q':
+            r->flags &= ~OUTPUT_SEQ;
+            return true;
+        case 'h':
+            out += "\x02holdoff=" + std::to_string(r->holdoff) + "\x04\r\n";
+            return true;
+        case 'm':
+            out += "\x02" "clock=" + std::to_string(reader_millis(r, Clock::now()));
+            out += "," + std::to_string(r->seq) + "\x04\r\n";
+            return true;
+    }
+    return false;
+}
+
+// As handle_serial_frame() in the sketch
+static void fleet_frame(Reader *r, const uint8_t *frame, uint8_t len) {
+    std::string out;
+    uint16_t id = 0;
+    bool have_id = false;
+    uint8_t index = 0;
+    bool ok = true;
+
+    stats.frames++;
+    if (r->waiting) {
+        auto took = Clock::now() - r->sent;
+        stats.latency_us.push_back(
+            std::chrono::duration_cast<std::chrono::microseconds>(took).count()
+        );
+        r->waiting = false;
+    }
+
+    while (len) {
+        uint8_t n = 0;
+        while (n < len && frame[n] != PACKET_CMD_SEP) {
+            n++;
+        }
+
+        if (!have_id && index == 0 && n > 1 && frame[0] == '#') {
+            if (!parse_u16(&id, &frame[1], n - 1)) {
+                stats.naks++;
+                send(r, "\x15");
+                return;
+            }
+            have_id = true;
+        } else if (!fleet_cmd(r, out, frame, n)) {
+            ok = false;
+            break;
+        } else {
+            index++;
+        }
+
+        if (n == len) {
+            break;
+        }
+        frame += n + 1;
+        len -= n + 1;
+    }
+
+    if (!ok) {
+        stats.naks++;
+    }
+    if (!have_id) {
+        if (!ok) {
+            out += '\x15';
+        }
+    } else if (ok) {
+        out += "\x02" "ack=" + std::to_string(id) + "\x04\r\n";
+    } else {
+        out += "\x02nak=" + std::to_string(id) + "," + std::to_string(index) + "\x04\r\n";
+    }
+    send(r, out);
+}
+
+static void received(Reader *r, const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t ch = buf[i];
+        if (ch == '\x02') {
+            r->cmdpos = 0;
+        } else if (ch == '\x04') {
+            if (r->cmdpos != 0xff) {
+                fleet_frame(r, r->cmd, r->cmdpos);
+            }
+            r->cmdpos = 0xff;
+        } else if (r->cmdpos == 0xff) {
+            continue;
+        } else if (r->cmdpos >= sizeof(r->cmd)) {
+            send(r, "\x15");
+            r->cmdpos = 0xff;
+        } else {
+            r->cmd[r->cmdpos++] = ch;
+        }
+    }
+}
+
+static void on_signal(int /* sig */) {
+    stopping = 1;
+}
+
+static bool parse_dist(const char *s) {
+    if (!strcmp(s, "fixed")) {
+        options.dist = DIST_FIXED;
+    } else if (!strcmp(s, "uniform")) {
+        options.dist = DIST_UNIFORM;
+    } else if (!strcmp(s, "poisson")) {
+        options.dist = DIST_POISSON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  -n, --readers N        simulated readers (default 16)\n"
+        "  -l, --link PREFIX      symlink each pty as PREFIX0, PREFIX1, ...\n"
+        "  -r, --rate TAPS        taps per second for each reader (default 0.5)\n"
+        "  -D, --dist NAME        gaps between taps: fixed, uniform or poisson\n"
+        "  -b, --burst N[,MS]     taps come in bursts of N, MS apart (default 1)\n"
+        "  -w, --dwell MS         how long each card is present (default 800)\n"
+        "  -c, --cards FILE       tap the cardid= values in FILE\n"
+        "  -p, --pool N           or tap N made up cards (default 1000)\n"
+        "  -N, --noise P          chance of debug text before a tap (default 0.1)\n"
+        "  -O, --output FLAGS     output flags at boot, as for the O command\n"
+        "  -R, --replay FILE      replay a serial log on every reader instead\n"
+        "  -s, --speed X          replay speed (default 1)\n"
+        "  -d, --duration SECS    how long to run for (default until interrupted)\n"
+        "  -S, --seed N           random number seed\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"readers",     required_argument, NULL, 'n'},
+        {"link",        required_argument, NULL, 'l'},
+        {"rate",        required_argument, NULL, 'r'},
+        {"dist",        required_argument, NULL, 'D'},
+        {"burst",       required_argument, NULL, 'b'},
+        {"dwell",       required_argument, NULL, 'w'},
+        {"cards",       required_argument, NULL, 'c'},
+        {"pool",        required_argument, NULL, 'p'},
+        {"noise",       required_argument, NULL, 'N'},
+        {"output",      required_argument, NULL, 'O'},
+        {"replay",      required_argument, NULL, 'R'},
+        {"speed",       required_argument, NULL, 's'},
+        {"duration",    required_argument, NULL, 'd'},
+        {"seed",        required_argument, NULL, 'S'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char *cards_file = NULL;
+    const char *replay_file = NULL;
+    size_t pool = 1000;
+    char *rest;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:l:r:D:b:w:c:p:N:O:R:s:d:S:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                options.readers = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                options.link = optarg;
+                break;
+            case 'r':
+                options.rate = strtod(optarg, NULL);
+                break;
+            case 'D':
+                if (!parse_dist(optarg)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'b':
+                options.burst = std::max(1UL, strtoul(optarg, &rest, 0));
+                if (*rest == ',') {
+                    options.burst_ms = strtoul(rest + 1, NULL, 0);
+                }
+                break;
+            case 'w':
+                options.dwell_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                cards_file = optarg;
+                break;
+            case 'p':
+                pool = std::max(1UL, strtoul(optarg, NULL, 0));
+                break;
+            case 'N':
+                options.noise = strtod(optarg, NULL);
+                break;
+            case 'O':
+                options.flags = strtoul(optarg, NULL, 0);
+                break;
+            case 'R':
+                replay_file = optarg;
+                break;
+            case 's':
+                options.speed = strtod(optarg, NULL);
+                break;
+            case 'd':
+                options.duration = strtod(optarg, NULL);
+                break;
+            case 'S':
+                rng_state = strtoull(optarg, NULL, 0) | 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (options.speed <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (cards_file) {
+        if (!load_cards(cards_file)) {
+            perror(cards_file);
+            return 1;
+        }
+    } else {
+        make_cards(pool);
+    }
+    if (replay_file && !load_replay(replay_file)) {
+        perror(replay_file);
+        return 1;
+    }
+
+    // One descriptor for each reader, plus a few
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < options.readers + 64) {
+        rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, options.readers + 64);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    std::vector<Reader> readers(options.readers);
+    for (uint32_t nr = 0; nr < options.readers; nr++) {
+        Reader *r = &readers[nr];
+        r->fd = pty_open(r->path, sizeof(r->path));
+        if (r->fd == -1 || !pty_open_hangup(r->path)) {
+            perror("pty");
+            return 1;
+        }
+        r->state = READER_DOWN;
+        r->cmdpos = 0xff;
+
+        if (options.link) {
+            std::string link = options.link + std::to_string(nr);
+            unlink(link.c_str());
+            if (symlink(r->path, link.c_str()) == -1) {
+                perror(link.c_str());
+                return 1;
+            }
+        }
+        printf("%s\n", r->path);
+    }
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    // The readers in the order that they are next due.  A reader that has
+    // been rescheduled since it was pushed is just skipped when it comes up.
+    typedef std::pair<Clock::time_point, uint32_t> Due;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> queue;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = Clock::time_point::max();
+    if (options.duration > 0) {
+        end = start + millis(options.duration * 1000);
+    }
+    Clock::time_point check = start;
+
+    struct epoll_event evs[64];
+    while (!stopping) {
+        Clock::time_point now = Clock::now();
+        if (now >= end) {
+            break;
+        }
+
+        // Look for ports that the host has opened
+        if (now >= check) {
+            for (uint32_t nr = 0; nr < options.readers; nr++) {
+                Reader *r = &readers[nr];
+                if (r->state != READER_DOWN || !pty_slave_open(r->fd)) {
+                    continue;
+                }
+                struct epoll_event ev = {};
+                ev.events = EPOLLIN;
+                ev.data.u32 = nr;
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, r->fd, &ev);
+                r->state = READER_BOOTING;
+                r->cmdpos = 0xff;
+                r->due = now + millis(FLEET_BOOT_MS);
+                queue.push(Due(r->due, nr));
+            }
+            check = now + millis(FLEET_CHECK_MS);
+        }
+
+        while (!queue.empty() && queue.top().first <= now) {
+            Due d = queue.top();
+            queue.pop();
+            Reader *r = &readers[d.second];
+            if (r->state == READER_DOWN || r->due != d.first) {
+                continue;
+            }
+            reader_due(r, now);
+            queue.push(Due(r->due, d.second));
+        }
+
+        Clock::time_point wake = std::min(check, end);
+        if (!queue.empty()) {
+            wake = std::min(wake, queue.top().first);
+        }
+        int timeout = 0;
+        if (wake > now) {
+            timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+        }
+
+        int n = epoll_wait(epoll_fd, evs, 64, timeout);
+        for (int i = 0; i < n; i++) {
+            uint32_t nr = evs[i].data.u32;
+            Reader *r = &readers[nr];
+            uint8_t buf[256];
+            ssize_t len;
+            while ((len = read(r->fd, buf, sizeof(buf))) > 0) {
+                received(r, buf, len);
+            }
+            if (len == -1 && errno != EAGAIN) {
+                // The host has closed the port
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, r->fd, NULL);
+                r->state = READER_DOWN;
+            }
+        }
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (options.link) {
+        for (uint32_t nr = 0; nr < options.readers; nr++) {
+            unlink((options.link + std::to_string(nr)).c_str());
+        }
+    }
+
+    std::vector<uint32_t> &lat = stats.latency_us;
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) -> double {
+        if (lat.empty()) {
+            return 0;
+        }
+        return lat[std::min(lat.size() - 1, (size_t)(lat.size() * p))] / 1000.0;
+    };
+
+    fprintf(stderr, "%7s %6s %8s %8s %8s %8s %6s %8s %8s %8s %8s\n",
+        "readers", "boots", "taps", "taps/s", "replies", "frames", "naks",
+        "p50_ms", "p99_ms", "max_ms", "overrun"
+    );
+    fprintf(stderr, "%7u %6llu %8llu %8.1f %8zu %8llu %6llu %8.3f %8.3f %8.3f %8llu\n",
+        options.readers, (unsigned long long)stats.boots,
+        (unsigned long long)stats.taps, stats.taps / secs, lat.size(),
+        (unsigned long long)stats.frames, (unsigned long long)stats.naks,
+        pct(0.50), pct(0.99), pct(1.0),
+        (unsigned long long)stats.overrun
+    );
+    return 0;
+}
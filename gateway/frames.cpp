@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Finds the framed messages in the bytes received from a reader
+ */
+
+#include <string.h>
+
+#include "frames.h"
+#include "packets.h"
+
+#define STX '\x02'
+#define EOT '\x04'
+#define MASK (FRAME_RING_SIZE - 1)
+
+uint8_t *FrameRing::write_ptr(size_t *space) {
+    if (head - tail == FRAME_RING_SIZE) {
+        // A frame that never ends, so give up on it
+        dropped_bytes += head - tail;
+        tail = scan = head;
+        in_frame = false;
+    }
+
+    size_t pos = head & MASK;
+    size_t free = FRAME_RING_SIZE - (head - tail);
+    *space = free < FRAME_RING_SIZE - pos ? free : FRAME_RING_SIZE - pos;
+    return &buf[pos];
+}
+
+void FrameRing::written(size_t n) {
+    head += n;
+}
+
+bool FrameRing::next_frame(FrameView *frame) {
+    while (scan < head) {
+        size_t pos = scan & MASK;
+        size_t n = head - scan;
+        if (n > FRAME_RING_SIZE - pos) {
+            n = FRAME_RING_SIZE - pos;
+        }
+        const uint8_t *p = &buf[pos];
+
+        if (!in_frame) {
+            const uint8_t *stx = (const uint8_t *)memchr(p, STX, n);
+            if (!stx) {
+                dropped_bytes += n;
+                scan += n;
+                tail = scan;
+                continue;
+            }
+            dropped_bytes += stx - p;
+            scan += stx - p + 1;
+            tail = start = scan;
+            in_frame = true;
+            continue;
+        }
+
+        const uint8_t *eot = (const uint8_t *)memchr(p, EOT, n);
+        size_t upto = eot ? eot - p : n;
+
+        // Binary records escape any STX, so this is always a new frame
+        const uint8_t *stx = (const uint8_t *)memrchr(p, STX, upto);
+        if (stx) {
+            dropped_bytes += scan + (stx - p) - start;
+            start = scan + (stx - p) + 1;
+            tail = start;
+        }
+
+        if (!eot) {
+            scan += n;
+            continue;
+        }
+
+        size_t end = scan + upto;
+        size_t first = start & MASK;
+        size_t len = end - start;
+        frame->part[0] = &buf[first];
+        if (first + len > FRAME_RING_SIZE) {
+            frame->len[0] = FRAME_RING_SIZE - first;
+            frame->part[1] = &buf[0];
+            frame->len[1] = len - frame->len[0];
+        } else {
+            frame->len[0] = len;
+            frame->part[1] = NULL;
+            frame->len[1] = 0;
+        }
+
+        scan = end + 1;
+        tail = scan;
+        in_frame = false;
+        frames++;
+        return true;
+    }
+    return false;
+}
+
+// Check for a key at the start of the frame, returning the length matched
+static size_t match_key(const FrameView &frame, const char *key) {
+    size_t i = 0;
+    while (key[i]) {
+        if (i >= frame.size() || frame.at(i) != (uint8_t)key[i]) {
+            return 0;
+        }
+        i++;
+    }
+    return i;
+}
+
+bool parse_event(const FrameView &frame, Event *ev) {
+    if (!frame.size() || frame.at(0) >= 0x80) {
+        // Empty, or a binary event record
+        return false;
+    }
+
+    size_t pos;
+    if ((pos = match_key(frame, "uid="))) {
+        ev->type = EVENT_UID;
+    } else if ((pos = match_key(frame, "serial="))) {
+        ev->type = EVENT_SERIAL;
+    } else if ((pos = match_key(frame, "cardid="))) {
+        ev->type = EVENT_CARDID;
+    } else {
+        return false;
+    }
+
+    // The value runs up to the first of any extra fields
+    size_t size = frame.size();
+    uint8_t len = 0;
+    while (pos < size && frame.at(pos) != ',') {
+        if (len == EVENT_ID_MAX) {
+            return false;
+        }
+        ev->id[len++] = frame.at(pos++);
+    }
+    ev->idlen = len;
+
+    if (ev->type == EVENT_UID && len == 4 && memcmp(ev->id, "NONE", 4) == 0) {
+        return false;
+    }
+
+    // Then look for the reader index, ignoring anything else
+    ev->reader = 0;
+    while (pos < size) {
+        pos++;  // The ','
+        static const char key[] = "reader=";
+        size_t i = 0;
+        while (key[i] && pos + i < size && frame.at(pos + i) == (uint8_t)key[i]) {
+            i++;
+        }
+        if (!key[i]) {
+            pos += i;
+            uint8_t reader = 0;
+            while (pos < size && frame.at(pos) >= '0' && frame.at(pos) <= '9') {
+                reader = reader * 10 + frame.at(pos++) - '0';
+            }
+            ev->reader = reader;
+        }
+        while (pos < size && frame.at(pos) != ',') {
+            pos++;
+        }
+    }
+    return true;
+}
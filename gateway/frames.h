@@ -0,0 +1,69 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Finds the STX/EOT framed messages (see packets.h) in the bytes received
+ * from a reader, without copying them out of the receive buffer.
+ *
+ * Each port has a FrameRing that read() writes straight into.  The frames
+ * are then found with memchr() and handed back as a FrameView, which points
+ * into the ring (in two parts, if the frame wraps around the end).  Any
+ * text outside a frame is dropped, as the README says it should not be
+ * interpreted, and a STX within a frame starts the frame again.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Must be a power of two, and bigger than the longest expected frame
+#define FRAME_RING_SIZE 4096
+
+// The longest card id that is kept from an event, eg "opal/3085221234567892"
+#define EVENT_ID_MAX    40
+
+// A frame body (without the STX and EOT)
+struct FrameView {
+    const uint8_t *part[2];
+    size_t len[2];
+
+    size_t size(void) const { return len[0] + len[1]; }
+    uint8_t at(size_t i) const {
+        return i < len[0] ? part[0][i] : part[1][i - len[0]];
+    }
+};
+
+class FrameRing {
+    public:
+        // Where the next read() should go, and how much will fit there.  If
+        // the ring is full of one unfinished frame, that frame is dropped.
+        uint8_t *write_ptr(size_t *space);
+        void written(size_t n);
+
+        // Find the next complete frame.  The view is only valid until the
+        // next call to write_ptr().
+        bool next_frame(FrameView *frame);
+
+        uint64_t frames = 0;
+        uint64_t dropped_bytes = 0;     // Text outside frames, or overlong
+
+    private:
+        uint8_t buf[FRAME_RING_SIZE];
+        size_t head = 0;        // Total bytes written
+        size_t tail = 0;        // Total bytes no longer needed
+        size_t scan = 0;        // Total bytes looked at
+        size_t start = 0;       // The first byte of the current frame body
+        bool in_frame = false;
+};
+
+// A card event, as handed to the decision workers
+struct Event {
+    uint8_t type;       // EVENT_UID, EVENT_SERIAL or EVENT_CARDID
+    uint8_t reader;     // Zero, unless the message says otherwise
+    uint8_t idlen;
+    char id[EVENT_ID_MAX];  // The value, as sent in the text message
+};
+
+// Parse a uid=, serial= or cardid= text message.  Returns false for any
+// other message, including uid=NONE and the binary event records.
+bool parse_event(const FrameView &frame, Event *ev);
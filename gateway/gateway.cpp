@@ -0,0 +1,470 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A gateway for many card readers on one Linux host
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "gateway.h"
+#include "packets.h"
+
+// The epoll data for anything that is not a port
+#define TOKEN_STOP  0xffffffff
+#define TOKEN_REPLY 0xfffffffe
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void eventfd_kick(int fd) {
+    uint64_t one = 1;
+    // Can only fail if the counter is about to overflow, which still wakes
+    if (write(fd, &one, sizeof(one))) {}
+}
+
+static void eventfd_clear(int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count))) {}
+}
+
+Gateway::Gateway(const GatewayOptions &options) : options(options) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    reply_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = TOKEN_STOP;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+    ev.data.u32 = TOKEN_REPLY;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, reply_fd, &ev);
+}
+
+Gateway::~Gateway() {
+    for (uint32_t nr = 0; nr < ports.size(); nr++) {
+        close_port(nr);
+        delete ports[nr];
+    }
+    for (Worker *w : workers) {
+        close(w->wake_fd);
+        delete w;
+    }
+    carddb_release(true);
+    delete carddb.load();
+    close(reply_fd);
+    close(stop_fd);
+    close(epoll_fd);
+}
+
+void Gateway::allow(const std::string &key) {
+    allowlist.insert(key);
+}
+
+bool Gateway::load_allowlist(const char *filename) {
+    std::ifstream f(filename);
+    if (!f) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(f, line)) {
+        if (!line.empty() && line[0] != '#') {
+            allow(line);
+        }
+    }
+    return true;
+}
+
+bool Gateway::use_carddb(const char *path) {
+    CardDb *db = CardDb::open(path);
+    if (!db) {
+        return false;
+    }
+    carddb_path = path;
+    carddb.store(db);
+    return true;
+}
+
+// Swap in the card database again if the file has been replaced
+void Gateway::carddb_reload(void) {
+    CardDb *db = carddb.load();
+    struct stat st;
+    if (stat(carddb_path.c_str(), &st) == -1) {
+        return;
+    }
+    if (db && st.st_dev == db->dev && st.st_ino == db->ino) {
+        return;
+    }
+
+    CardDb *fresh = CardDb::open(carddb_path.c_str());
+    if (!fresh) {
+        // Keep using the old one, and try again next time
+        return;
+    }
+    carddb.store(fresh);
+    reloads++;
+
+    if (db) {
+        Retired r;
+        r.db = db;
+        for (Worker *w : workers) {
+            r.passes.push_back(w->passes.load());
+        }
+        retired.push_back(r);
+    }
+}
+
+// Unmap any replaced card databases that no worker can still be using
+void Gateway::carddb_release(bool all) {
+    for (size_t i = 0; i < retired.size();) {
+        bool busy = false;
+        for (size_t j = 0; !all && j < workers.size(); j++) {
+            Worker *w = workers[j];
+            if (w->passes.load() == retired[i].passes[j] && !w->sleeping.load()) {
+                busy = true;
+            }
+        }
+        if (busy) {
+            i++;
+            continue;
+        }
+        delete retired[i].db;
+        retired.erase(retired.begin() + i);
+    }
+}
+
+bool Gateway::add_port(const char *path) {
+    Port *port = new Port;
+    port->path = path;
+    ports.push_back(port);
+    return open_port(ports.size() - 1);
+}
+
+bool Gateway::open_port(uint32_t nr) {
+    Port *port = ports[nr];
+
+    int fd = open(port->path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        port->reopen_ms = now_ms() + GATEWAY_REOPEN_MS;
+        return false;
+    }
+
+    // The readers talk at 115200 8N1, with no translations
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B115200);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = nr;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        close(fd);
+        port->reopen_ms = now_ms() + GATEWAY_REOPEN_MS;
+        return false;
+    }
+
+    port->fd = fd;
+    port->out.clear();
+    return true;
+}
+
+void Gateway::close_port(uint32_t nr) {
+    Port *port = ports[nr];
+    if (port->fd == -1) {
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, port->fd, NULL);
+    close(port->fd);
+    port->fd = -1;
+    port->reopen_ms = now_ms() + GATEWAY_REOPEN_MS;
+}
+
+void Gateway::reopen_ports(void) {
+    uint64_t now = now_ms();
+    for (uint32_t nr = 0; nr < ports.size(); nr++) {
+        if (ports[nr]->fd == -1 && now >= ports[nr]->reopen_ms) {
+            if (open_port(nr)) {
+                reopens++;
+            }
+        }
+    }
+}
+
+void Gateway::port_readable(uint32_t nr) {
+    Port *port = ports[nr];
+    Worker *w = workers[nr % workers.size()];
+
+    while (port->fd != -1) {
+        size_t space;
+        uint8_t *p = port->ring.write_ptr(&space);
+        ssize_t n = read(port->fd, p, space);
+        if (n <= 0) {
+            if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+            }
+            // Gone away (a pty gives EIO once the other side closes)
+            close_port(nr);
+            return;
+        }
+        port->ring.written(n);
+
+        FrameView frame;
+        WorkItem item;
+        item.port = nr;
+        while (port->ring.next_frame(&frame)) {
+            if (!parse_event(frame, &item.ev)) {
+                continue;
+            }
+            events++;
+            if (!w->in.push(item)) {
+                queue_full++;
+                continue;
+            }
+            w->pending = true;
+        }
+    }
+}
+
+void Gateway::send(uint32_t nr, const char *buf, size_t len) {
+    Port *port = ports[nr];
+    if (port->fd == -1) {
+        return;
+    }
+
+    if (port->out.empty()) {
+        ssize_t n = write(port->fd, buf, len);
+        if (n == (ssize_t)len) {
+            return;
+        }
+        if (n > 0) {
+            buf += n;
+            len -= n;
+        }
+    }
+
+    if (port->out.size() + len > GATEWAY_OUT_MAX) {
+        out_full++;
+        return;
+    }
+    if (port->out.empty()) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u32 = nr;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, port->fd, &ev);
+    }
+    port->out.append(buf, len);
+}
+
+void Gateway::port_writable(uint32_t nr) {
+    Port *port = ports[nr];
+    if (port->fd == -1) {
+        return;
+    }
+
+    ssize_t n = write(port->fd, port->out.data(), port->out.size());
+    if (n > 0) {
+        port->out.erase(0, n);
+    }
+    if (port->out.empty()) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = nr;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, port->fd, &ev);
+    }
+}
+
+void Gateway::replies(void) {
+    static const char allow_frame[] = "\x02" GATEWAY_ALLOW_CMD "\x04";
+    static const char deny_frame[] = "\x02" GATEWAY_DENY_CMD "\x04";
+
+    Reply reply;
+    for (Worker *w : workers) {
+        while (w->out.pop(reply)) {
+            if (reply.allow) {
+                send(reply.port, allow_frame, sizeof(allow_frame) - 1);
+            } else {
+                send(reply.port, deny_frame, sizeof(deny_frame) - 1);
+            }
+            if (options.verbose) {
+                printf("%s reader=%u cardid=%.*s %s\n",
+                    ports[reply.port]->path.c_str(), reply.ev.reader,
+                    reply.ev.idlen, reply.ev.id,
+                    reply.allow ? "allow" : "deny"
+                );
+            }
+        }
+    }
+}
+
+bool Gateway::decide(CardDb *db, const Event &ev) {
+    if (db) {
+        uint16_t value;
+        return db->lookup(ev.id, ev.idlen, &value) && (value & CARDDB_ALLOW);
+    }
+    return allowlist.empty() || allowlist.count(std::string(ev.id, ev.idlen));
+}
+
+void Gateway::worker_run(Worker *w) {
+    WorkItem item;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        // Only this batch may use the database, see carddb_release()
+        CardDb *db = carddb.load();
+        unsigned done = 0;
+        while (w->in.pop(item)) {
+            if (item.ev.type != EVENT_CARDID) {
+                // The uid= and serial= only matter to a logging host
+                continue;
+            }
+
+            Reply reply;
+            reply.port = item.port;
+            reply.ev = item.ev;
+            reply.allow = decide(db, item.ev);
+
+            w->decisions.fetch_add(1, std::memory_order_relaxed);
+            if (reply.allow) {
+                w->allowed.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (!w->out.push(reply)) {
+                w->out_full.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            done++;
+        }
+        w->passes.fetch_add(1);
+        if (done) {
+            eventfd_kick(reply_fd);
+            continue;
+        }
+
+        // Nothing to do, so sleep until kicked.  The flag is set before the
+        // last look at the queue, so a push cannot be missed.
+        w->sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (w->in.empty() && !stopping.load()) {
+            eventfd_clear(w->wake_fd);
+        }
+        w->sleeping.store(false);
+    }
+}
+
+void Gateway::run(void) {
+    for (unsigned i = 0; i < (options.workers ? options.workers : 1); i++) {
+        Worker *w = new Worker;
+        // Blocking, so that an idle worker can sleep in read()
+        w->wake_fd = eventfd(0, EFD_CLOEXEC);
+        workers.push_back(w);
+    }
+    for (Worker *w : workers) {
+        w->thread = std::thread(&Gateway::worker_run, this, w);
+    }
+
+    struct epoll_event evs[64];
+    while (!stopping.load()) {
+        int timeout = -1;
+        if (!carddb_path.empty()) {
+            timeout = GATEWAY_RELOAD_MS;
+        }
+        for (Port *port : ports) {
+            if (port->fd == -1) {
+                timeout = GATEWAY_REOPEN_MS;
+                break;
+            }
+        }
+
+        int n = epoll_wait(epoll_fd, evs, 64, timeout);
+        if (n == -1 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint32_t token = evs[i].data.u32;
+            if (token == TOKEN_STOP) {
+                continue;
+            }
+            if (token == TOKEN_REPLY) {
+                eventfd_clear(reply_fd);
+                replies();
+                continue;
+            }
+            if (evs[i].events & EPOLLOUT) {
+                port_writable(token);
+            }
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                port_readable(token);
+            }
+        }
+
+        // One wakeup for each worker that was given anything this time
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (Worker *w : workers) {
+            if (w->pending) {
+                w->pending = false;
+                if (w->sleeping.load()) {
+                    eventfd_kick(w->wake_fd);
+                }
+            }
+        }
+
+        if (timeout != -1) {
+            reopen_ports();
+        }
+        if (!carddb_path.empty() && now_ms() >= carddb_check_ms) {
+            carddb_check_ms = now_ms() + GATEWAY_RELOAD_MS;
+            carddb_reload();
+        }
+        if (!retired.empty()) {
+            carddb_release(false);
+        }
+    }
+
+    for (Worker *w : workers) {
+        eventfd_kick(w->wake_fd);
+        w->thread.join();
+    }
+    replies();
+}
+
+void Gateway::stop(void) {
+    stopping.store(true);
+    eventfd_kick(stop_fd);
+}
+
+GatewayStats Gateway::stats(void) {
+    GatewayStats s = {};
+    for (Port *port : ports) {
+        s.frames += port->ring.frames;
+        s.dropped_bytes += port->ring.dropped_bytes;
+    }
+    s.events = events;
+    s.queue_full = queue_full;
+    s.out_full = out_full;
+    s.reopens = reopens;
+    s.reloads = reloads;
+    for (Worker *w : workers) {
+        s.decisions += w->decisions.load();
+        s.allowed += w->allowed.load();
+        s.out_full += w->out_full.load();
+    }
+    return s;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A gateway for many card readers on one Linux host.
+ *
+ * One I/O thread watches every reader's tty with epoll, finds the framed
+ * messages in each port's FrameRing and hands the card events to a pool of
+ * decision workers.  Each worker has its own pair of lock-free queues (one
+ * for events in and one for replies out), and all of the events from one
+ * port go to the same worker, so they stay in order.  The workers decide
+ * on each cardid= and queue the LED command frame to send back, which the
+ * I/O thread then writes to the port.
+ *
+ * The decisions come from a card database (see carddb.h) if one is given,
+ * or else from a simple allowlist.  The database file is checked once a
+ * second, and when it has been replaced the new one is mapped and swapped
+ * in without stopping the workers.  The old one is unmapped once every
+ * worker has moved on from it.
+ *
+ * A port that goes away (eg a USB serial adaptor being unplugged) is
+ * reopened once a second until it comes back.
+ */
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "carddb.h"
+#include "frames.h"
+#include "spsc.h"
+
+#define GATEWAY_QUEUE_SIZE  1024    // Events (and replies) per worker
+#define GATEWAY_OUT_MAX     4096    // Unsent bytes kept for a slow port
+#define GATEWAY_REOPEN_MS   1000
+#define GATEWAY_RELOAD_MS   1000
+
+// The LED commands sent back for each decision (see the README)
+#define GATEWAY_ALLOW_CMD   "L0,9,3000;L1,0"
+#define GATEWAY_DENY_CMD    "L0,0;L1,1,3000"
+
+struct GatewayOptions {
+    unsigned workers = 4;
+    bool verbose = false;   // Log each decision to stdout
+};
+
+struct GatewayStats {
+    uint64_t frames;
+    uint64_t dropped_bytes;     // Text outside frames
+    uint64_t events;
+    uint64_t decisions;
+    uint64_t allowed;
+    uint64_t queue_full;        // Events lost to a full worker queue
+    uint64_t out_full;          // Replies lost to a port not keeping up
+    uint64_t reopens;
+    uint64_t reloads;           // Times the card database was replaced
+};
+
+class Gateway {
+    public:
+        Gateway(const GatewayOptions &options);
+        ~Gateway();
+
+        // Add a key (as sent in cardid=) to the allowlist.  With no keys,
+        // every card is allowed.  Only call this before run().
+        void allow(const std::string &key);
+        bool load_allowlist(const char *filename);
+
+        // Decide using a card database instead of the allowlist, returning
+        // false if it cannot be opened.  Only call this before run().
+        bool use_carddb(const char *path);
+
+        // Open a reader's tty, returning false if it could not be opened.
+        // Only call this before run().
+        bool add_port(const char *path);
+
+        // Handle the ports until stop() is called
+        void run(void);
+
+        // Can be called from any thread, or from a signal handler
+        void stop(void);
+
+        GatewayStats stats(void);
+
+    private:
+        struct Port {
+            std::string path;
+            int fd = -1;
+            FrameRing ring;
+            std::string out;    // Not yet written
+            uint64_t reopen_ms = 0;
+        };
+
+        struct WorkItem {
+            uint32_t port;
+            Event ev;
+        };
+
+        struct Reply {
+            uint32_t port;
+            bool allow;
+            Event ev;
+        };
+
+        struct Worker {
+            std::thread thread;
+            int wake_fd = -1;
+            std::atomic<bool> sleeping{false};
+            std::atomic<uint64_t> passes{0};    // Batches finished
+            bool pending = false;   // Items pushed since the last wakeup
+            SpscQueue<WorkItem, GATEWAY_QUEUE_SIZE> in;
+            SpscQueue<Reply, GATEWAY_QUEUE_SIZE> out;
+            std::atomic<uint64_t> decisions{0};
+            std::atomic<uint64_t> allowed{0};
+            std::atomic<uint64_t> out_full{0};
+        };
+
+        // A card database that has been replaced, and how far each worker
+        // had got when it was
+        struct Retired {
+            CardDb *db;
+            std::vector<uint64_t> passes;
+        };
+
+        GatewayOptions options;
+        std::unordered_set<std::string> allowlist;
+        std::string carddb_path;
+        std::atomic<CardDb *> carddb{nullptr};
+        std::vector<Retired> retired;
+        uint64_t carddb_check_ms = 0;
+        std::vector<Port *> ports;
+        std::vector<Worker *> workers;
+        int epoll_fd;
+        int stop_fd;
+        int reply_fd;
+        std::atomic<bool> stopping{false};
+
+        uint64_t events = 0;
+        uint64_t queue_full = 0;
+        uint64_t out_full = 0;
+        uint64_t reopens = 0;
+        uint64_t reloads = 0;
+
+        bool open_port(uint32_t nr);
+        void close_port(uint32_t nr);
+        void reopen_ports(void);
+        void port_readable(uint32_t nr);
+        void port_writable(uint32_t nr);
+        void send(uint32_t nr, const char *buf, size_t len);
+        void replies(void);
+        bool decide(CardDb *db, const Event &ev);
+        void carddb_reload(void);
+        void carddb_release(bool all);
+        void worker_run(Worker *w);
+};
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * The reader gateway daemon, see gateway.h
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gateway.h"
+
+static Gateway *running;
+
+static void on_signal(int /* sig */) {
+    if (running) {
+        running->stop();
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] tty...\n"
+        "\n"
+        "  -w, --workers N        decision worker threads (default 4)\n"
+        "  -a, --allowlist FILE   only allow the cardid values listed in FILE\n"
+        "  -d, --carddb FILE      decide using a card database from carddb_build\n"
+        "  -v, --verbose          log each decision to stdout\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"workers",     required_argument, NULL, 'w'},
+        {"allowlist",   required_argument, NULL, 'a'},
+        {"carddb",      required_argument, NULL, 'd'},
+        {"verbose",     no_argument,       NULL, 'v'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    GatewayOptions options;
+    const char *allowlist = NULL;
+    const char *carddb = NULL;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w:a:d:vh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                options.workers = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                allowlist = optarg;
+                break;
+            case 'd':
+                carddb = optarg;
+                break;
+            case 'v':
+                options.verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Gateway gw(options);
+    if (allowlist && !gw.load_allowlist(allowlist)) {
+        perror(allowlist);
+        return 1;
+    }
+    if (carddb && !gw.use_carddb(carddb)) {
+        perror(carddb);
+        return 1;
+    }
+    for (int i = optind; i < argc; i++) {
+        if (!gw.add_port(argv[i])) {
+            // It will be tried again, as it may just be unplugged
+            perror(argv[i]);
+        }
+    }
+
+    running = &gw;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    gw.run();
+
+    GatewayStats s = gw.stats();
+    fprintf(stderr,
+        "frames=%llu dropped_bytes=%llu events=%llu decisions=%llu allowed=%llu "
+        "queue_full=%llu out_full=%llu reopens=%llu reloads=%llu\n",
+        (unsigned long long)s.frames, (unsigned long long)s.dropped_bytes,
+        (unsigned long long)s.events, (unsigned long long)s.decisions,
+        (unsigned long long)s.allowed, (unsigned long long)s.queue_full,
+        (unsigned long long)s.out_full, (unsigned long long)s.reopens,
+        (unsigned long long)s.reloads
+    );
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Pseudo-terminals that stand in for readers
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "pty.h"
+
+int pty_open(char *path, size_t len) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (grantpt(fd) || unlockpt(fd) || ptsname_r(fd, path, len)) {
+        close(fd);
+        return -1;
+    }
+
+    // No echo or line handling, before anything has the other side open
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    return fd;
+}
+
+bool pty_slave_open(int fd) {
+    struct pollfd pfd = {fd, 0, 0};
+    if (poll(&pfd, 1, 0) == -1) {
+        return false;
+    }
+    return !(pfd.revents & POLLHUP);
+}
+
+bool pty_open_hangup(const char *path) {
+    int fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Pseudo-terminals that stand in for readers, for the benchmark and the
+ * fleet generator.  The tool keeps the master side and whatever is being
+ * tested opens the slave side, just as it would a USB serial port.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#define PTY_PATH_MAX 64
+
+// Open a non-blocking pty master in raw mode, and fill in the slave path.
+// Returns -1 on failure.
+int pty_open(char *path, size_t len);
+
+// Whether anything has the slave side open.  Only valid once the slave has
+// been opened at least once (see pty_open_hangup()).
+bool pty_slave_open(int fd);
+
+// Open and close the slave side, so that the master sees a hangup until
+// the next time something opens it
+bool pty_open_hangup(const char *path);
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A bounded, lock-free, single producer and single consumer queue.
+ *
+ * The producer only ever writes tail and the consumer only ever writes head,
+ * so each side needs just an acquire load of the other side's index and a
+ * release store of its own.  The two indexes are kept on separate cache
+ * lines, so that the threads are not fighting over one line.
+ */
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+    public:
+        // Returns false if the queue is full
+        bool push(const T &item) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head_cache == N) {
+                head_cache = head.load(std::memory_order_acquire);
+                if (t - head_cache == N) {
+                    return false;
+                }
+            }
+            slots[t & (N - 1)] = item;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Returns false if the queue is empty
+        bool pop(T &item) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail_cache) {
+                tail_cache = tail.load(std::memory_order_acquire);
+                if (h == tail_cache) {
+                    return false;
+                }
+            }
+            item = slots[h & (N - 1)];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool empty(void) const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        // Only used by the consumer, along with its last look at tail
+        alignas(64) std::atomic<size_t> head{0};
+        size_t tail_cache = 0;
+
+        // Only used by the producer, along with its last look at head
+        alignas(64) std::atomic<size_t> tail{0};
+        size_t head_cache = 0;
+
+        alignas(64) T slots[N];
+};
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Keeps each PN532 working without needing the Arduino to be reset
+ */
+
+#include <Arduino.h>
+
+#include "arduino_cardreader.h"
+#include "health.h"
+#include "packets.h"
+
+struct health_entry {
+    uint8_t state;
+    uint32_t version;
+    unsigned long since;    // When it went down, or was last tried
+};
+
+static struct health_entry table[HEALTH_READERS];
+
+static void report_state(Print& p, uint8_t nr, uint8_t state) {
+    unsigned long now = millis();
+
+    // The reader might not be the one that events are coming from
+    uint8_t reader = packet_reader;
+    packet_reader = nr;
+    if (output_flags & OUTPUT_BINARY) {
+        packet_event(p, EVENT_READER, state == HEALTH_UP, NULL, 0, now);
+    } else {
+        packet_start(p);
+        if (state == HEALTH_UP) {
+            p.print(F("reader=up"));
+        } else {
+            p.print(F("reader=down"));
+        }
+        packet_event_end(p, now);
+    }
+    packet_reader = reader;
+}
+
+void health_begin(PN532& nfc, uint8_t nr) {
+    struct health_entry *e = &table[nr];
+    e->since = millis();
+    e->state = pn532_begin_start(nfc) ? HEALTH_STARTING : HEALTH_DOWN;
+}
+
+bool health_up(uint8_t nr) {
+    return table[nr].state == HEALTH_UP;
+}
+
+uint32_t health_version(uint8_t nr) {
+    return table[nr].version;
+}
+
+uint8_t health_check(Print& p, PN532& nfc, uint8_t nr, bool report) {
+    struct health_entry *e = &table[nr];
+
+    switch (e->state) {
+        case HEALTH_UP:
+            if (nfc.errors < HEALTH_ERRORS_MAX) {
+                break;
+            }
+            e->state = HEALTH_DOWN;
+            e->since = millis();
+            if (report) {
+                report_state(p, nr, HEALTH_DOWN);
+            }
+            // Try to bring it back straight away, as it may just have been
+            // reset
+            health_begin(nfc, nr);
+            break;
+
+        case HEALTH_STARTING:
+            if (!pn532_begin_done(nfc, &e->version)) {
+                break;
+            }
+            if (!e->version) {
+                e->state = HEALTH_DOWN;
+                break;
+            }
+            nfc.errors = 0;
+            e->state = HEALTH_UP;
+            if (report) {
+                report_state(p, nr, HEALTH_UP);
+            }
+            break;
+
+        case HEALTH_DOWN:
+            if (millis() - e->since >= HEALTH_RETRY_MILLIS) {
+                health_begin(nfc, nr);
+            }
+            break;
+    }
+    return e->state;
+}
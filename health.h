@@ -0,0 +1,54 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Keeps each PN532 working without needing the Arduino to be reset.
+ *
+ * A PN532 that keeps failing (missing its ACK, not answering or sending bad
+ * frames) is taken out of use, with a reader=down message, and is then woken
+ * up and configured again in the background, being tried every little while
+ * until it answers.  Once it does, a reader=up message is sent and it goes
+ * back to polling for cards.  This covers a PN532 that has been reset by a
+ * brownout, or that has hung, without the door being out of action until
+ * someone power cycles it.
+ *
+ * The bringing up is the same as at boot, so the readers are all configured
+ * at once there too, instead of one after another.
+ */
+#pragma once
+
+#include <Print.h>
+#include <stdint.h>
+
+#include "pn532.h"
+
+#define HEALTH_READERS      2
+
+#define HEALTH_DOWN         0   // Not answering, waiting to be tried again
+#define HEALTH_STARTING     1   // Being woken up and configured
+#define HEALTH_UP           2
+
+// How many PN532 faults in a row mean that it has stopped working
+#ifndef HEALTH_ERRORS_MAX
+#define HEALTH_ERRORS_MAX   2
+#endif
+
+// How long to wait before trying a PN532 that did not answer again
+#ifndef HEALTH_RETRY_MILLIS
+#define HEALTH_RETRY_MILLIS 100
+#endif
+
+// Start bringing up a reader
+void health_begin(PN532& nfc, uint8_t nr);
+
+// Whether the reader is ready for card operations
+bool health_up(uint8_t nr);
+
+// The firmware version of the reader, from when it was last brought up
+uint32_t health_version(uint8_t nr);
+
+// Notice a reader that has stopped working and bring it back, returning its
+// state.  The reader must not be in the middle of a card operation, as any
+// command it is running may be replaced.  With report set, the reader=
+// messages are sent to p.
+uint8_t health_check(Print& p, PN532& nfc, uint8_t nr, bool report);
@@ -6,20 +6,62 @@
  */
 
 #include <stdint.h>
+#include <avr/pgmspace.h>
 #include <Print.h>
 
+static const char hexchars[] PROGMEM = "0123456789ABCDEF";
+
 // If only Serial.print(xyzzy, HEX) did leading zeros
 // (The lack of leading zeros has been raised before and they do not appear
 // to be interested in addressing it)
+//
+// The digits are built up in chunks, so that each chunk is a single write
 void hexdump(Print& p, uint8_t *buf, uint8_t size) {
+    char chunk[32];
+    uint8_t pos = 0;
+
     while(size) {
         uint8_t ch = *buf;
-        if (ch < 0x10) {
-            p.print('0');
-        }
-        p.print(ch, HEX);
+        chunk[pos++] = pgm_read_byte(&hexchars[ch >> 4]);
+        chunk[pos++] = pgm_read_byte(&hexchars[ch & 0xf]);
 
         buf++;
         size--;
+
+        if (pos == sizeof(chunk) || !size) {
+            p.write((uint8_t *)chunk, pos);
+            pos = 0;
+        }
+    }
+}
+
+static int8_t hexdigit(uint8_t ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    ch |= 0x20;     // lowercase
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    return -1;
+}
+
+uint8_t hexparse(uint8_t *buf, uint8_t size, uint8_t *hex, uint8_t hexlen) {
+    if ((hexlen & 1) || (hexlen / 2) > size) {
+        return 0;
+    }
+
+    uint8_t len = 0;
+    while(hexlen) {
+        int8_t hi = hexdigit(hex[0]);
+        int8_t lo = hexdigit(hex[1]);
+        if (hi < 0 || lo < 0) {
+            return 0;
+        }
+        buf[len++] = (hi << 4) | lo;
+
+        hex += 2;
+        hexlen -= 2;
     }
+    return len;
 }
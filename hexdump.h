@@ -10,3 +10,7 @@
 
 /* Dump a memory buffer to serial */
 void hexdump(Print& p, uint8_t *buf, uint8_t size);
+
+/* The reverse: fill buf from hex digits, returning the number of bytes or
+ * zero if the input is not valid hex or does not fit */
+uint8_t hexparse(uint8_t *buf, uint8_t size, uint8_t *hex, uint8_t hexlen);
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A scriptable stand-in for the (hacked) Adafruit_PN532 library.
+ *
+ * Each instance is attached, by its SS pin, to a simulated chip from
+ * mock_pn532.h which answers from scripted card profiles.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define PN532_PREAMBLE          (0x00)
+#define PN532_STARTCODE1        (0x00)
+#define PN532_STARTCODE2        (0xFF)
+#define PN532_POSTAMBLE         (0x00)
+
+#define PN532_HOSTTOPN532       (0xD4)
+#define PN532_PN532TOHOST       (0xD5)
+
+#define PN532_COMMAND_GETFIRMWAREVERSION    (0x02)
+#define PN532_COMMAND_SAMCONFIGURATION      (0x14)
+#define PN532_COMMAND_INDATAEXCHANGE        (0x40)
+#define PN532_COMMAND_INAUTOPOLL            (0x60)
+
+#define PN532_SPI_STATREAD      (0x02)
+#define PN532_SPI_DATAWRITE     (0x01)
+#define PN532_SPI_DATAREAD      (0x03)
+#define PN532_SPI_READY         (0x01)
+
+#define PN532_MIFARE_ISO14443A  0x00
+
+#define MIFARE_CMD_AUTH_A       0x60
+#define MIFARE_CMD_AUTH_B       0x61
+#define MIFARE_CMD_READ         0x30
+#define MIFARE_CMD_WRITE        0xA0
+#define MIFARE_ULTRALIGHT_CMD_WRITE 0xA2
+
+class MockPN532;
+
+class Adafruit_PN532 {
+    public:
+        Adafruit_PN532(uint8_t ss);
+
+        void begin(void);
+        uint32_t getFirmwareVersion(void);
+        bool SAMConfig(void);
+
+        uint8_t inAutoPoll(uint8_t *buf, uint8_t buflen);
+        bool inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength);
+
+    private:
+        MockPN532 *chip;
+};
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A minimal stand-in for the Arduino core, sufficient to build the sketch
+ * as a normal Linux program.
+ *
+ * Time is virtual: it only moves forward when the simulated hardware (the
+ * serial port, the mock PN532) says that something took time.  This makes
+ * every run deterministic and lets a benchmark report what the real
+ * hardware would have seen.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/pgmspace.h>
+#include <Print.h>
+#include <HardwareSerial.h>
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+
+#define LED_BUILTIN 13
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// Each pin is given a port of its own, so direct port writes can be seen
+// with host_pin_state() just like digitalWrite()
+#define digitalPinToPort(pin)       (pin)
+#define digitalPinToBitMask(pin)    (1)
+volatile uint8_t *portOutputRegister(uint8_t port);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Interrupt masking is meaningless on the host, but the timer registers
+// are kept as plain variables so ledtimer.cpp can be built unchanged
+#define cli()
+#define sei()
+
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t OCR1A;
+extern volatile uint8_t TIMSK1;
+extern volatile uint8_t TIFR1;
+
+#define WGM12   3
+#define CS12    2
+#define OCIE1A  1
+#define OCF1A   1
+
+#define ISR(vector) extern "C" void vector(void); extern "C" void vector(void)
+
+/*
+ * Host-only controls for the simulation
+ */
+
+// The virtual clock, in microseconds since boot
+uint64_t host_now_us(void);
+
+// Move the virtual clock forward, firing the LED timer ISR as needed
+void host_advance_us(uint64_t us);
+
+// The state last written to a digital pin
+uint8_t host_pin_state(uint8_t pin);
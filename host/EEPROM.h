@@ -0,0 +1,33 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Host version of the Arduino EEPROM library, with the 1KiB size of the
+ * ATmega328P.  The contents start out erased, as on a new chip.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+class EEPROMClass {
+    public:
+        EEPROMClass() { memset(data, 0xff, sizeof(data)); }
+
+        uint8_t read(int idx) { return data[idx]; }
+        void write(int idx, uint8_t val) { data[idx] = val; writes++; }
+        void update(int idx, uint8_t val) {
+            if (data[idx] != val) {
+                write(idx, val);
+            }
+        }
+        uint16_t length() { return sizeof(data); }
+
+        // Host-only count of the bytes actually written
+        uint32_t writes = 0;
+
+    private:
+        uint8_t data[1024];
+};
+
+static EEPROMClass EEPROM;
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Host version of the Arduino HardwareSerial.
+ *
+ * Transmitted bytes are captured for inspection and the transmit side is
+ * modelled like the AVR core: a small buffer drained at the configured baud
+ * rate, with writers blocking (advancing the virtual clock) when it is full.
+ */
+#pragma once
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Print.h>
+
+#define SERIAL_TX_BUFFER_SIZE 64
+
+class HardwareSerial : public Print {
+    public:
+        void begin(unsigned long baud);
+        void end(void) {}
+        operator bool() { return true; }
+
+        int available(void);
+        int peek(void);
+        int read(void);
+        void flush(void);
+
+        int availableForWrite(void) override;
+        size_t write(uint8_t) override;
+        using Print::write;
+
+        /*
+         * Host-only controls
+         */
+
+        // Queue bytes as if the host had sent them to the device
+        void host_inject(const uint8_t *buf, size_t size);
+        void host_inject(const char *str);
+
+        // Queue bytes to arrive at a later virtual time
+        void host_inject_at(uint64_t when_us, const char *str);
+
+        // Install a hook that sees each transmitted byte, along with the
+        // virtual time when it will have finished leaving the UART
+        typedef void (*tx_hook_t)(uint8_t ch, uint64_t done_us, void *arg);
+        void host_set_tx_hook(tx_hook_t hook, void *arg);
+
+        uint64_t host_tx_bytes(void) { return tx_bytes; }
+
+    private:
+        uint32_t byte_us = 87;      // ten bit times at 115200 baud
+        uint64_t tx_done_us = 0;    // when the last queued byte is sent
+        uint64_t tx_bytes = 0;
+
+        uint8_t rx[256];
+        uint16_t rx_head = 0;
+        uint16_t rx_tail = 0;
+
+        struct pending_rx {
+            uint64_t when_us;
+            uint8_t ch;
+        };
+        std::deque<pending_rx> rx_pending;
+
+        tx_hook_t tx_hook = NULL;
+        void *tx_hook_arg = NULL;
+};
+
+extern HardwareSerial Serial;
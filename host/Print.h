@@ -0,0 +1,61 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Host version of the Arduino Print class.  Only the parts used by the
+ * sketch are implemented, but the overloads match the AVR core so that
+ * the same calls pick the same formatting.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class Print {
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t) = 0;
+        virtual size_t write(const uint8_t *buf, size_t size);
+        size_t write(const char *str);
+        size_t write(const char *buf, size_t size) {
+            return write((const uint8_t *)buf, size);
+        }
+
+        virtual int availableForWrite() { return 0; }
+
+        size_t print(const __FlashStringHelper *);
+        size_t print(const char[]);
+        size_t print(char);
+        size_t print(unsigned char, int = DEC);
+        size_t print(int, int = DEC);
+        size_t print(unsigned int, int = DEC);
+        size_t print(long, int = DEC);
+        size_t print(unsigned long, int = DEC);
+        size_t print(double, int = 2);
+
+        size_t println(const __FlashStringHelper *);
+        size_t println(const char[]);
+        size_t println(char);
+        size_t println(unsigned char, int = DEC);
+        size_t println(int, int = DEC);
+        size_t println(unsigned int, int = DEC);
+        size_t println(long, int = DEC);
+        size_t println(unsigned long, int = DEC);
+        size_t println(double, int = 2);
+        size_t println(void);
+
+    private:
+        size_t printNumber(unsigned long, uint8_t);
+};
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Host version of the Arduino SPI library.
+ *
+ * A simulated device can be attached to a slave select pin.  It is
+ * selected when the sketch drives that pin low and then sees each byte
+ * transferred, with every byte advancing the virtual clock by the time it
+ * would take at the configured SPI clock rate.
+ *
+ * As on the real hardware, nothing works until begin() has been called, so
+ * using the bus before that stops the program.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LSBFIRST    0
+#define MSBFIRST    1
+
+#define SPI_MODE0   0x00
+#define SPI_MODE1   0x04
+#define SPI_MODE2   0x08
+#define SPI_MODE3   0x0c
+
+class SPISettings {
+    public:
+        SPISettings(uint32_t clock, uint8_t /* bitOrder */, uint8_t /* dataMode */)
+            : clock(clock) {}
+        SPISettings() : clock(4000000) {}
+
+        uint32_t clock;
+};
+
+class SPIClass {
+    public:
+        void begin(void) { begun = true; }
+        void end(void) { begun = false; }
+        void beginTransaction(SPISettings settings);
+        void endTransaction(void) {}
+        uint8_t transfer(uint8_t data);
+        void transfer(void *buf, size_t count);
+
+    private:
+        uint32_t clock = 4000000;
+        bool begun = false;
+};
+
+extern SPIClass SPI;
+
+/*
+ * Host-only controls
+ */
+
+class HostSPIDevice {
+    public:
+        virtual void host_select(bool selected) = 0;
+        virtual uint8_t host_transfer(uint8_t data) = 0;
+};
+
+// Attach a simulated device to a slave select pin
+void host_spi_attach(uint8_t ss, HostSPIDevice *dev);
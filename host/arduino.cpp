@@ -0,0 +1,369 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A minimal stand-in for the Arduino core, sufficient to build the sketch
+ * as a normal Linux program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <Arduino.h>
+#include <SPI.h>
+
+/*
+ * Virtual time and the timer1 LED tick
+ */
+
+static uint64_t now_us;
+static uint64_t next_tick_us = 100000;
+
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint16_t TCNT1;
+volatile uint16_t OCR1A;
+volatile uint8_t TIMSK1;
+volatile uint8_t TIFR1;
+
+extern "C" void TIMER1_COMPA_vect(void) __attribute__((weak));
+
+uint64_t host_now_us(void) {
+    return now_us;
+}
+
+void host_advance_us(uint64_t us) {
+    uint64_t until = now_us + us;
+
+    // The sketch configures timer1 for a 100ms tick
+    while (next_tick_us <= until) {
+        now_us = next_tick_us;
+        next_tick_us += 100000;
+        if ((TIMSK1 & (1 << OCIE1A)) && TIMER1_COMPA_vect) {
+            TIMER1_COMPA_vect();
+        }
+    }
+    now_us = until;
+}
+
+unsigned long millis(void) {
+    // Truncate to 32 bits, like the AVR
+    return (uint32_t)(now_us / 1000);
+}
+
+unsigned long micros(void) {
+    return (uint32_t)now_us;
+}
+
+void delay(unsigned long ms) {
+    host_advance_us((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    host_advance_us(us);
+}
+
+/*
+ * Digital pins
+ */
+
+static volatile uint8_t pin_state[32];
+
+void pinMode(uint8_t /* pin */, uint8_t /* mode */) {
+}
+
+static HostSPIDevice *spi_devices[32];
+static HostSPIDevice *spi_selected;
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin >= sizeof(pin_state)) {
+        return;
+    }
+    if (spi_devices[pin] && pin_state[pin] != val) {
+        // Slave select is active low
+        spi_selected = val ? NULL : spi_devices[pin];
+        spi_devices[pin]->host_select(!val);
+    }
+    pin_state[pin] = val;
+}
+
+int digitalRead(uint8_t pin) {
+    return host_pin_state(pin);
+}
+
+volatile uint8_t *portOutputRegister(uint8_t port) {
+    static volatile uint8_t unused;
+    if (port < sizeof(pin_state)) {
+        return &pin_state[port];
+    }
+    return &unused;
+}
+
+uint8_t host_pin_state(uint8_t pin) {
+    if (pin < sizeof(pin_state)) {
+        return pin_state[pin];
+    }
+    return LOW;
+}
+
+/*
+ * SPI
+ */
+
+SPIClass SPI;
+
+void host_spi_attach(uint8_t ss, HostSPIDevice *dev) {
+    if (ss < sizeof(pin_state)) {
+        spi_devices[ss] = dev;
+        // Slave select idles high
+        pin_state[ss] = HIGH;
+    }
+}
+
+void SPIClass::beginTransaction(SPISettings settings) {
+    if (!begun) {
+        // The SCK and MOSI pins would not even be outputs
+        fprintf(stderr, "SPI used before SPI.begin()\n");
+        abort();
+    }
+    clock = settings.clock;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    // Eight clocks, plus a little time for the sketch to move the byte
+    host_advance_us(8000000 / clock + 2);
+
+    if (!spi_selected) {
+        return 0xff;
+    }
+    return spi_selected->host_transfer(data);
+}
+
+// The AVR core keeps the next byte ready while each one is clocked out, so
+// a burst only pays the per-call time once
+void SPIClass::transfer(void *buf, size_t count) {
+    uint8_t *p = (uint8_t *)buf;
+    host_advance_us(2);
+    while (count--) {
+        host_advance_us(8000000 / clock);
+        *p = spi_selected ? spi_selected->host_transfer(*p) : 0xff;
+        p++;
+    }
+}
+
+/*
+ * Print
+ */
+
+size_t Print::write(const uint8_t *buf, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buf++);
+    }
+    return n;
+}
+
+size_t Print::write(const char *str) {
+    return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base) {
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+
+    *str = '\0';
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return write(str);
+}
+
+size_t Print::print(const __FlashStringHelper *s) {
+    return write((const char *)s);
+}
+
+size_t Print::print(const char s[]) {
+    return write(s);
+}
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char b, int base) {
+    return print((unsigned long)b, base);
+}
+
+size_t Print::print(int n, int base) {
+    return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base) {
+    if (base == 0) {
+        return write((uint8_t)n);
+    }
+    if (base == 10 && n < 0) {
+        return print('-') + printNumber(-n, 10);
+    }
+    return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    if (base == 0) {
+        return write((uint8_t)n);
+    }
+    return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
+
+size_t Print::println(void) {
+    return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper *s) {
+    return print(s) + println();
+}
+
+size_t Print::println(const char s[]) {
+    return print(s) + println();
+}
+
+size_t Print::println(char c) {
+    return print(c) + println();
+}
+
+size_t Print::println(unsigned char b, int base) {
+    return print(b, base) + println();
+}
+
+size_t Print::println(int n, int base) {
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned int n, int base) {
+    return print(n, base) + println();
+}
+
+size_t Print::println(long n, int base) {
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned long n, int base) {
+    return print(n, base) + println();
+}
+
+size_t Print::println(double n, int digits) {
+    return print(n, digits) + println();
+}
+
+/*
+ * HardwareSerial
+ */
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud) {
+    // One start bit, eight data bits and one stop bit
+    byte_us = (10 * 1000000UL + baud - 1) / baud;
+}
+
+int HardwareSerial::available(void) {
+    uint64_t now = host_now_us();
+    while (!rx_pending.empty() && rx_pending.front().when_us <= now) {
+        uint8_t ch = rx_pending.front().ch;
+        rx_pending.pop_front();
+        host_inject(&ch, 1);
+    }
+    return (uint16_t)(rx_head - rx_tail);
+}
+
+int HardwareSerial::peek(void) {
+    if (rx_head == rx_tail) {
+        return -1;
+    }
+    return rx[rx_tail % sizeof(rx)];
+}
+
+int HardwareSerial::read(void) {
+    int ch = peek();
+    if (ch >= 0) {
+        rx_tail++;
+    }
+    return ch;
+}
+
+void HardwareSerial::host_inject(const uint8_t *buf, size_t size) {
+    while (size-- && (uint16_t)(rx_head - rx_tail) < sizeof(rx)) {
+        rx[rx_head++ % sizeof(rx)] = *buf++;
+    }
+}
+
+void HardwareSerial::host_inject(const char *str) {
+    host_inject((const uint8_t *)str, strlen(str));
+}
+
+void HardwareSerial::host_inject_at(uint64_t when_us, const char *str) {
+    // The bytes arrive one after another, at the line rate
+    while (*str) {
+        when_us += byte_us;
+        rx_pending.push_back({when_us, (uint8_t)*str++});
+    }
+}
+
+void HardwareSerial::host_set_tx_hook(tx_hook_t hook, void *arg) {
+    tx_hook = hook;
+    tx_hook_arg = arg;
+}
+
+int HardwareSerial::availableForWrite(void) {
+    uint64_t now = host_now_us();
+    if (tx_done_us <= now) {
+        return SERIAL_TX_BUFFER_SIZE - 1;
+    }
+    int queued = (tx_done_us - now + byte_us - 1) / byte_us;
+    if (queued >= SERIAL_TX_BUFFER_SIZE - 1) {
+        return 0;
+    }
+    return SERIAL_TX_BUFFER_SIZE - 1 - queued;
+}
+
+size_t HardwareSerial::write(uint8_t ch) {
+    while (!availableForWrite()) {
+        // The AVR core busy-waits for space in the buffer
+        host_advance_us(byte_us);
+    }
+
+    uint64_t now = host_now_us();
+    if (tx_done_us < now) {
+        tx_done_us = now;
+    }
+    tx_done_us += byte_us;
+    tx_bytes++;
+
+    if (tx_hook) {
+        tx_hook(ch, tx_done_us, tx_hook_arg);
+    }
+    return 1;
+}
+
+void HardwareSerial::flush(void) {
+    uint64_t now = host_now_us();
+    if (tx_done_us > now) {
+        host_advance_us(tx_done_us - now);
+    }
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Host version of avr-libc pgmspace.h - on the host, "program memory" is
+ * just ordinary memory.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+#define pgm_read_dword(p)   (*(const uint32_t *)(p))
+#define pgm_read_ptr(p)     (*(void * const *)(p))
+#define memcpy_P            memcpy
+#define memcmp_P            memcmp
+#define strlen_P            strlen
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Cost of each InDataExchange, split into the time on the bus and the time
+ * spent in the driver itself.
+ *
+ * For each card family, every scripted exchange is first run once over the
+ * simulated SPI bus (with the card answering instantly), noting the virtual
+ * time taken and recording the bytes that the PN532 sent back.  The same
+ * exchanges are then run many times against a PN532Recorded playing back
+ * that recording, which takes the bus out of the picture, and the real
+ * time taken gives the cost of framing and checking in the driver.
+ */
+
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "mock_pn532.h"
+#include "pn532.h"
+#include "profiles.h"
+
+#define PN532_SS   (10)
+
+using Clock = std::chrono::steady_clock;
+
+// Passes everything through to another transport, keeping a copy of what
+// the PN532 sent
+class Recorder : public PN532Transport {
+    public:
+        Recorder(PN532Transport& inner) : inner(inner) {};
+
+        std::vector<uint8_t> data;
+        uint32_t written = 0;
+
+        void wakeup(void) override { inner.wakeup(); };
+        bool ready(void) override { return inner.ready(); };
+        void start(uint8_t op) override {
+            reading = op == PN532_SPI_DATAREAD;
+            inner.start(op);
+        };
+        void transfer(uint8_t *buf, uint8_t len) override {
+            if (!reading) {
+                written += len;
+            }
+            inner.transfer(buf, len);
+            if (reading) {
+                data.insert(data.end(), buf, buf + len);
+            }
+        };
+        void end(void) override { inner.end(); };
+
+    private:
+        PN532Transport& inner;
+        bool reading = false;
+};
+
+// Run every scripted exchange once, returning how many succeeded
+static uint32_t run_exchanges(PN532& nfc, const std::vector<MockTarget> &targets) {
+    uint32_t ok = 0;
+    for (const MockTarget &t : targets) {
+        for (const MockExchange &x : t.exchanges) {
+            uint8_t cmd[255];
+            uint8_t res[255];
+            uint8_t reslen = sizeof(res);
+            memcpy(cmd, x.req.data(), x.req.size());
+            ok += pn532_exchange(nfc, t.data[0], cmd, x.req.size(), res, &reslen);
+        }
+    }
+    return ok;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  -n, --repeat N         times to play back each recording (default 20000)\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"repeat",      required_argument, NULL, 'n'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    uint32_t repeat = 20000;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                repeat = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    MockPN532 &chip = mock_pn532(PN532_SS);
+    chip.ack_us = 0;
+    chip.exchange_us = 0;
+    PN532SPI spi(PN532_SS);
+    spi.wakeup();
+
+    printf("%-10s %5s %9s %8s %9s %10s\n",
+        "family", "exch", "bytes_out", "bytes_in", "bus_us", "driver_ns"
+    );
+
+    int failed = 0;
+    for (const Profile &p : profiles) {
+        // The card answers instantly, so only the bus takes any time, and
+        // the exchanges that fail are left out as they only time out
+        std::vector<MockTarget> targets = p.targets;
+        uint32_t exchanges = 0;
+        for (MockTarget &t : targets) {
+            std::vector<MockExchange> keep;
+            for (MockExchange &x : t.exchanges) {
+                if (!x.res.empty()) {
+                    x.delay_us = 0;
+                    keep.push_back(x);
+                }
+            }
+            t.exchanges = keep;
+            exchanges += keep.size();
+        }
+        if (!exchanges) {
+            continue;
+        }
+        chip.present(targets, host_now_us());
+
+        Recorder rec(spi);
+        PN532 live(rec);
+        uint64_t start_us = host_now_us();
+        uint32_t ok = run_exchanges(live, targets);
+        uint64_t bus_us = host_now_us() - start_us;
+
+        PN532Recorded playback(rec.data.data(), rec.data.size());
+        PN532 replay(playback);
+        uint64_t replayed = 0;
+        Clock::time_point start = Clock::now();
+        for (uint32_t i = 0; i < repeat; i++) {
+            playback.rewind();
+            replayed += run_exchanges(replay, targets);
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        printf("%-10s %5u %9.1f %8.1f %9.1f %10.1f\n",
+            p.name.c_str(), exchanges,
+            (double)rec.written / exchanges, (double)rec.data.size() / exchanges,
+            (double)bus_us / exchanges, ns / ((double)repeat * exchanges)
+        );
+
+        if (ok != exchanges || replayed != (uint64_t)ok * repeat) {
+            fprintf(stderr, "%s: %u of %u exchanges worked, %llu replayed\n",
+                p.name.c_str(), ok, exchanges, (unsigned long long)replayed);
+            failed = 1;
+        }
+        chip.remove(host_now_us());
+    }
+    return failed;
+}
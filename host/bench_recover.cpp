@@ -0,0 +1,266 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Boot and reader recovery benchmark for the host build of the sketch.
+ *
+ * First, the virtual time from power on to the first InAutoPoll reaching
+ * the simulated PN532 is measured.  Then the PN532 is made to fail, either
+ * losing its power for a while (so it comes back unconfigured) or hanging
+ * for a while, at different points in the poll cycle.  For each fault we
+ * measure the time until the reader=down message, the time from the PN532
+ * working again (or from reader=down, if that was later) to the reader=up
+ * message, and then the time for a card placed straight afterwards to be
+ * read.  A short hang may not be noticed at all, which is fine as long as
+ * the card is still read.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "mock_pn532.h"
+#include "profiles.h"
+
+void setup(void);
+void loop(void);
+
+#define PN532_SS   (10)
+
+// Bounds each wait, so a regression cannot hang the benchmark
+#define WAIT_US 10000000
+
+// Longer than any command timeout, so a fault would have been noticed
+#define SETTLE_US 2000000
+
+// The time taken by a pass of the main loop that does nothing
+#define LOOP_US 20
+
+// Watches the bytes transmitted by the sketch and notes interesting packets
+struct Capture {
+    bool verbose;
+    bool in_frame;
+    std::string frame;
+
+    uint64_t down_us;
+    uint64_t up_us;
+    uint64_t cardid_us;
+};
+
+static void capture_tx(uint8_t ch, uint64_t done_us, void *arg) {
+    Capture *cap = (Capture *)arg;
+
+    if (cap->verbose) {
+        putchar(ch);
+    }
+
+    if (ch == '\x02') {
+        cap->in_frame = true;
+        cap->frame.clear();
+        return;
+    }
+    if (!cap->in_frame) {
+        return;
+    }
+    if (ch != '\x04') {
+        cap->frame += (char)ch;
+        return;
+    }
+
+    cap->in_frame = false;
+    if (cap->frame.compare(0, 11, "reader=down") == 0) {
+        cap->down_us = done_us;
+    }
+    if (cap->frame.compare(0, 9, "reader=up") == 0) {
+        cap->up_us = done_us;
+    }
+    if (cap->frame.compare(0, 7, "cardid=") == 0) {
+        cap->cardid_us = done_us;
+    }
+}
+
+// Run the main loop once.  With every reader down, nothing in it takes any
+// virtual time, so the time that the real loop would take is added.
+static void step(void) {
+    uint64_t before = host_now_us();
+    loop();
+    if (host_now_us() == before) {
+        host_advance_us(LOOP_US);
+    }
+}
+
+struct Result {
+    uint32_t faults;
+    uint32_t missed;            // Never came back up, or the card was not read
+    uint32_t downs;
+    uint64_t down_max;
+    uint64_t down_sum;
+    uint64_t up_max;
+    uint64_t up_sum;
+    uint64_t tap_max;
+    uint64_t tap_sum;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  -n, --faults N         faults of each kind and length (default 20)\n"
+        "  -p, --profile NAME     the card to read after each fault (default hsl)\n"
+        "  -v, --verbose          copy the sketch serial output to stdout\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"faults",      required_argument, NULL, 'n'},
+        {"profile",     required_argument, NULL, 'p'},
+        {"verbose",     no_argument,       NULL, 'v'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    uint32_t faults = 20;
+    const char *card = "hsl";
+    Capture cap = {};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:p:vh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                faults = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                card = optarg;
+                break;
+            case 'v':
+                cap.verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    const Profile *profile = NULL;
+    for (const Profile &p : profiles) {
+        if (p.name == card) {
+            profile = &p;
+        }
+    }
+    if (!profile) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    MockPN532 &chip = mock_pn532(PN532_SS);
+    Serial.host_set_tx_hook(capture_tx, &cap);
+
+    setup();
+    while (!chip.stats.autopolls && host_now_us() < WAIT_US) {
+        step();
+    }
+    printf("boot_ms=%.2f\n", host_now_us() / 1000.0);
+
+    // Let the boot messages and LED timeouts settle
+    while (host_now_us() < 1000000) {
+        step();
+    }
+
+    printf("%-6s %8s %6s %6s %6s %9s %9s %9s %9s %9s %9s\n",
+        "fault", "fault_ms", "faults", "downs", "missed",
+        "down_avg", "down_max", "up_avg", "up_max", "tap_avg", "tap_max"
+    );
+
+    static const uint32_t lengths_ms[] = {5, 100, 1000, 5000};
+    uint32_t seed = 1;
+    int failed = 0;
+
+    for (int reset = 1; reset >= 0; reset--) {
+        for (uint32_t length_ms : lengths_ms) {
+            Result r = {};
+
+            for (uint32_t i = 0; i < faults; i++) {
+                // Spread the faults over the poll cycle
+                seed = seed * 1103515245 + 12345;
+                uint64_t from_us = host_now_us() + (seed >> 8) % chip.poll_empty_us;
+                uint64_t until_us = from_us + length_ms * 1000ULL;
+                chip.fault(from_us, until_us, reset);
+
+                cap.down_us = 0;
+                cap.up_us = 0;
+                // Once it is working again, wait for it to come back up,
+                // or for long enough that it would have been noticed
+                while (host_now_us() < until_us + WAIT_US) {
+                    uint64_t now = host_now_us();
+                    if (now >= until_us && (cap.down_us ? cap.up_us : now >= until_us + SETTLE_US)) {
+                        break;
+                    }
+                    step();
+                }
+
+                r.faults++;
+
+                // A short hang can go unnoticed, as long as the reader is
+                // still working afterwards
+                if (cap.down_us) {
+                    r.downs++;
+                    uint64_t down = cap.down_us - from_us;
+                    r.down_sum += down;
+                    r.down_max = down > r.down_max ? down : r.down_max;
+                }
+                if (cap.down_us && !cap.up_us) {
+                    r.missed++;
+                    continue;
+                }
+                if (cap.up_us) {
+                    // From when it could first have come back
+                    uint64_t back_us = cap.down_us > until_us ? cap.down_us : until_us;
+                    uint64_t up = cap.up_us > back_us ? cap.up_us - back_us : 0;
+                    r.up_sum += up;
+                    r.up_max = up > r.up_max ? up : r.up_max;
+                }
+
+                // Then a card, which has to be read
+                uint64_t place_us = host_now_us();
+                cap.cardid_us = 0;
+                chip.present(profile->targets, place_us);
+                while (!cap.cardid_us && host_now_us() < place_us + WAIT_US) {
+                    step();
+                }
+                if (!cap.cardid_us) {
+                    r.missed++;
+                } else {
+                    uint64_t tap = cap.cardid_us - place_us;
+                    r.tap_sum += tap;
+                    r.tap_max = tap > r.tap_max ? tap : r.tap_max;
+                }
+
+                // And taken away again, ready for the next fault
+                chip.remove(host_now_us());
+                uint64_t remove_us = host_now_us();
+                while (host_now_us() < remove_us + 1000000) {
+                    step();
+                }
+            }
+
+            uint32_t ok = r.faults - r.missed;
+            printf("%-6s %8u %6u %6u %6u %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+                reset ? "power" : "hang", length_ms, r.faults, r.downs, r.missed,
+                r.downs ? r.down_sum / 1000.0 / r.downs : 0.0, r.down_max / 1000.0,
+                ok ? r.up_sum / 1000.0 / ok : 0.0, r.up_max / 1000.0,
+                ok ? r.tap_sum / 1000.0 / ok : 0.0, r.tap_max / 1000.0
+            );
+            if (r.missed) {
+                failed = 1;
+            }
+        }
+    }
+
+    chip.fault(UINT64_MAX, 0, false);
+    return failed;
+}
@@ -0,0 +1,386 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tap latency benchmark for the host build of the sketch.
+ *
+ * For each card family, a scripted card is repeatedly placed in front of
+ * the simulated reader and then removed again.  We measure the virtual time
+ * from the card entering the field to the final byte of the cardid= message
+ * leaving the UART, along with how many bytes the sketch sent for the tap.
+ *
+ * With --probe, a command is also sent to the sketch part way through each
+ * tap, and we measure how long it takes for the reply to arrive.
+ *
+ * With --readers 2, a second simulated reader is fitted and each tap places
+ * a different card on both readers at once.  The latency is then the time
+ * until both cardid= messages have been sent.
+ *
+ * With --steady, the host time is left out, so that the results (and, with
+ * --verbose, the sketch output) are the same on every run.  make check
+ * compares them with the copies in tests/golden.
+ */
+
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "arduino_cardreader.h"
+#include "mock_pn532.h"
+#include "packets.h"
+#include "profiles.h"
+
+void setup(void);
+void loop(void);
+
+// The second reader is set by the Makefile, as the sketch needs it too
+#define PN532_SS   (10)
+
+// Watches the bytes transmitted by the sketch and notes interesting packets
+struct Capture {
+    bool verbose;
+    bool in_frame;
+    std::string frame;
+
+    uint64_t cardid_us;
+    uint64_t cardid_bytes;
+    uint8_t cardids;
+    uint8_t departed;
+    uint64_t reply_us;
+};
+
+static void capture_tx(uint8_t ch, uint64_t done_us, void *arg) {
+    Capture *cap = (Capture *)arg;
+
+    if (cap->verbose) {
+        putchar(ch);
+    }
+
+    if (ch == '\x02') {
+        cap->in_frame = true;
+        cap->frame.clear();
+        return;
+    }
+    if (!cap->in_frame) {
+        return;
+    }
+    if (ch != '\x04') {
+        cap->frame += (char)ch;
+        return;
+    }
+
+    cap->in_frame = false;
+
+    // Either text messages or binary event records
+    uint8_t event = cap->frame.empty() ? 0 : (uint8_t)cap->frame[0];
+    if (cap->frame.compare(0, 7, "cardid=") == 0 || event == EVENT_CARDID) {
+        cap->cardid_us = done_us;
+        cap->cardid_bytes = Serial.host_tx_bytes();
+        cap->cardids++;
+    }
+    if (cap->frame.compare(0, 8, "uid=NONE") == 0 || event == EVENT_DEPART) {
+        cap->departed++;
+    }
+    if (cap->frame.compare(0, 8, "holdoff=") == 0) {
+        cap->reply_us = done_us;
+    }
+}
+
+struct Result {
+    uint32_t taps;
+    uint32_t missed;
+    uint64_t latency_min;
+    uint64_t latency_max;
+    uint64_t latency_sum;
+    uint64_t bytes_cardid;
+    uint64_t bytes_total;
+    uint64_t exchanges;
+    uint64_t reply_max;
+    uint64_t reply_sum;
+    double host_ns;
+};
+
+// Bounds each wait, so a regression cannot hang the benchmark
+#define WAIT_US 5000000
+
+// Change the UID of every target, so that it looks like a different card
+static void vary_uid(std::vector<MockTarget> &targets, uint8_t key) {
+    for (MockTarget &t : targets) {
+        if (t.type == TYPE_FELICA_212 || t.type == TYPE_FELICA_424) {
+            // The IDm is also part of every FeliCa command and answer, so
+            // the script needs changing to match
+            if (t.data.size() >= 11) {
+                t.data[10] ^= key;
+            }
+            for (MockExchange &e : t.exchanges) {
+                if (e.req.size() >= 10) {
+                    e.req[9] ^= key;
+                }
+                if (e.res.size() >= 10) {
+                    e.res[9] ^= key;
+                }
+            }
+        } else if (t.data.size() > 4 && t.data[4]) {
+            // The last UID byte
+            t.data[4 + t.data[4]] ^= key;
+        }
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  -n, --taps N           taps per card family (default 100)\n"
+        "  -p, --profile NAME     only run the named card family\n"
+        "  -e, --exchange-us US   default InDataExchange time\n"
+        "  -P, --poll-us US       InAutoPoll time with no card present\n"
+        "  -f, --found-us US      InAutoPoll time once a card is present\n"
+        "  -c, --capture          enable trace capture (see trace.h)\n"
+        "  -x, --command CMD      send a framed command to the sketch at boot\n"
+        "  -u, --unique           change the UID on every tap (defeats the cache)\n"
+        "  -k, --probe            measure the reply time of a command sent mid-tap\n"
+        "  -r, --readers N        fit N simulated readers (1 or 2)\n"
+        "  -s, --steady           leave out the host time, so the output repeats\n"
+        "  -v, --verbose          copy the sketch serial output to stdout\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"taps",        required_argument, NULL, 'n'},
+        {"profile",     required_argument, NULL, 'p'},
+        {"exchange-us", required_argument, NULL, 'e'},
+        {"poll-us",     required_argument, NULL, 'P'},
+        {"found-us",    required_argument, NULL, 'f'},
+        {"capture",     no_argument,       NULL, 'c'},
+        {"command",     required_argument, NULL, 'x'},
+        {"unique",      no_argument,       NULL, 'u'},
+        {"probe",       no_argument,       NULL, 'k'},
+        {"readers",     required_argument, NULL, 'r'},
+        {"steady",      no_argument,       NULL, 's'},
+        {"verbose",     no_argument,       NULL, 'v'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    uint32_t taps = 100;
+    const char *only = NULL;
+    MockPN532 &chip = mock_pn532(PN532_SS);
+    Capture cap = {};
+    bool unique = false;
+    bool probe = false;
+    uint32_t readers = 1;
+    bool steady = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:p:e:P:f:cx:ukr:svh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                taps = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                only = optarg;
+                break;
+            case 'e':
+                chip.exchange_us = strtoul(optarg, NULL, 0);
+                break;
+            case 'P':
+                chip.poll_empty_us = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                chip.poll_found_us = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                Serial.host_inject("\x02" "c" "\x04");
+                break;
+            case 'x':
+                Serial.host_inject("\x02");
+                Serial.host_inject(optarg);
+                Serial.host_inject("\x04");
+                break;
+            case 'u':
+                unique = true;
+                break;
+            case 'k':
+                probe = true;
+                break;
+            case 'r':
+                readers = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                steady = true;
+                break;
+            case 'v':
+                cap.verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (readers < 1 || readers > 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Any extra reader has the same timings as the first
+    std::vector<MockPN532 *> chips = {&chip};
+    if (readers > 1) {
+        MockPN532 &chip2 = mock_pn532(PN532_SS2);
+        chip2.exchange_us = chip.exchange_us;
+        chip2.poll_empty_us = chip.poll_empty_us;
+        chip2.poll_found_us = chip.poll_found_us;
+        chips.push_back(&chip2);
+    }
+
+    Serial.host_set_tx_hook(capture_tx, &cap);
+    setup();
+
+    // Let the boot messages and LED timeouts settle
+    while (host_now_us() < 1000000) {
+        loop();
+    }
+
+    printf("%-8s %5s %6s %9s %9s %9s %8s %8s %9s",
+        "family", "taps", "missed", "exch/tap",
+        "min_ms", "avg_ms", "max_ms",
+        "bytes_id", "bytes/tap"
+    );
+    if (!steady) {
+        printf(" %8s", "host_us");
+    }
+    if (probe) {
+        printf(" %9s %9s", "cmd_avg", "cmd_max");
+    }
+    printf("\n");
+
+    // A simple LCG keeps the card arrival times spread over the poll cycle
+    // while still being repeatable
+    uint32_t seed = 1;
+
+    for (const Profile &profile : profiles) {
+        if (only && profile.name != only) {
+            continue;
+        }
+
+        Result r = {};
+        r.latency_min = UINT64_MAX;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (uint32_t i = 0; i < taps; i++) {
+            seed = seed * 1103515245 + 12345;
+            uint64_t place_us = host_now_us() + (seed >> 8) % chip.poll_empty_us;
+            uint64_t place_bytes = Serial.host_tx_bytes();
+            uint32_t exchanges = 0;
+            for (MockPN532 *c : chips) {
+                exchanges += c->stats.exchanges;
+            }
+
+            cap.cardid_us = 0;
+            cap.cardids = 0;
+            for (uint8_t nr = 0; nr < chips.size(); nr++) {
+                std::vector<MockTarget> targets = profile.targets;
+                if (unique) {
+                    // Every tap looks like a new card
+                    vary_uid(targets, i + 1);
+                }
+                if (nr) {
+                    // And each reader gets a different card
+                    vary_uid(targets, 0x80);
+                }
+                chips[nr]->present(targets, place_us);
+            }
+
+            // The command lands somewhere during the poll or the card reads
+            uint64_t probe_us = place_us + (seed >> 4) % 60000;
+            cap.reply_us = 0;
+            if (probe) {
+                Serial.host_inject_at(probe_us, "\x02" "h" "\x04");
+            }
+
+            while (cap.cardids < readers && host_now_us() < place_us + WAIT_US) {
+                loop();
+            }
+
+            r.taps++;
+            if (cap.cardids >= readers) {
+                uint64_t latency = cap.cardid_us - place_us;
+                r.latency_sum += latency;
+                if (latency < r.latency_min) {
+                    r.latency_min = latency;
+                }
+                if (latency > r.latency_max) {
+                    r.latency_max = latency;
+                }
+                r.bytes_cardid += cap.cardid_bytes - place_bytes;
+            } else {
+                r.missed++;
+            }
+
+            cap.departed = 0;
+            for (MockPN532 *c : chips) {
+                c->remove(host_now_us());
+            }
+            uint64_t remove_us = host_now_us();
+            while (cap.departed < readers && host_now_us() < remove_us + WAIT_US) {
+                loop();
+            }
+
+            if (probe) {
+                while (!cap.reply_us && host_now_us() < probe_us + WAIT_US) {
+                    loop();
+                }
+                uint64_t reply = cap.reply_us - probe_us;
+                r.reply_sum += reply;
+                if (reply > r.reply_max) {
+                    r.reply_max = reply;
+                }
+            }
+
+            for (MockPN532 *c : chips) {
+                r.exchanges += c->stats.exchanges;
+            }
+            r.exchanges -= exchanges;
+            r.bytes_total += Serial.host_tx_bytes() - place_bytes;
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        r.host_ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+        uint32_t ok = r.taps - r.missed;
+        if (!ok) {
+            r.latency_min = 0;
+            ok = 1;
+        }
+
+        printf("%-8s %5u %6u %9.1f %9.2f %9.2f %8.2f %8.1f %9.1f",
+            profile.name.c_str(), r.taps, r.missed,
+            (double)r.exchanges / r.taps,
+            r.latency_min / 1000.0,
+            r.latency_sum / 1000.0 / ok,
+            r.latency_max / 1000.0,
+            (double)r.bytes_cardid / ok,
+            (double)r.bytes_total / r.taps
+        );
+        if (!steady) {
+            printf(" %8.2f", r.host_ns / 1000.0 / r.taps);
+        }
+        if (probe) {
+            printf(" %9.2f %9.2f",
+                r.reply_sum / 1000.0 / r.taps,
+                r.reply_max / 1000.0
+            );
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
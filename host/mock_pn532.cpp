@@ -0,0 +1,412 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A simulated PN532, driven by scripted card profiles.
+ */
+
+#include <map>
+
+#include <Arduino.h>
+#include <Adafruit_PN532.h>
+
+#include "mock_pn532.h"
+
+static std::map<uint8_t, MockPN532> chips;
+
+MockPN532 &mock_pn532(uint8_t ss) {
+    return chips.try_emplace(ss, ss).first->second;
+}
+
+MockPN532 *mock_pn532_find(uint8_t ss) {
+    auto it = chips.find(ss);
+    if (it == chips.end()) {
+        return NULL;
+    }
+    return &it->second;
+}
+
+MockPN532::MockPN532(uint8_t ss) {
+    host_spi_attach(ss, this);
+}
+
+void MockPN532::present(const std::vector<MockTarget> &new_targets, uint64_t when_us) {
+    targets = new_targets;
+    present_us = when_us;
+    remove_us = UINT64_MAX;
+}
+
+void MockPN532::remove(uint64_t when_us) {
+    remove_us = when_us;
+}
+
+void MockPN532::fault(uint64_t from_us, uint64_t until_us, bool reset) {
+    fault_from_us = from_us;
+    fault_until_us = until_us;
+    fault_reset = reset;
+}
+
+// Whether the chip is not answering, throwing away anything it was doing
+bool MockPN532::faulted(uint64_t now) {
+    if (now < fault_from_us || now >= fault_until_us) {
+        return false;
+    }
+    if (fault_reset) {
+        ack_ready = false;
+        response_pending = false;
+        autopoll_pending = false;
+        configured = false;
+    }
+    return true;
+}
+
+bool MockPN532::in_field(uint64_t when_us) {
+    if (targets.empty()) {
+        return false;
+    }
+    return when_us >= present_us && when_us < remove_us;
+}
+
+// The result of an InAutoPoll started at the given time, with the time it
+// takes added to busy_us
+uint8_t MockPN532::do_autopoll(uint64_t now, uint8_t *buf, uint8_t buflen) {
+
+    if (!in_field(now)) {
+        // The card might arrive part way through the poll period, in which
+        // case the next sweep will find it
+        uint64_t sweep = now;
+        if (!targets.empty() && present_us > now) {
+            sweep += (present_us - now + poll_sweep_us - 1) / poll_sweep_us * poll_sweep_us;
+        }
+        if (sweep <= now || sweep >= now + poll_empty_us || sweep >= remove_us) {
+            take_us(poll_empty_us);
+            return 0;
+        }
+        take_us(sweep - now);
+    }
+    take_us(poll_found_us);
+
+    uint8_t found = 0;
+    uint8_t pos = 0;
+    for (const MockTarget &t : targets) {
+        if (pos + 2 + t.data.size() > buflen) {
+            break;
+        }
+        buf[pos++] = t.type;
+        buf[pos++] = t.data.size();
+        memcpy(&buf[pos], t.data.data(), t.data.size());
+        pos += t.data.size();
+        found++;
+    }
+    return found;
+}
+
+bool MockPN532::do_exchange(uint8_t tg, const uint8_t *send, uint8_t sendlen, uint8_t *res, uint8_t *reslen) {
+    stats.exchanges++;
+
+    if (exchange_hook) {
+        bool ok = exchange_hook(send, sendlen, res, reslen);
+        if (!ok) {
+            stats.failed++;
+        }
+        return ok;
+    }
+
+    if (in_field(host_now_us())) {
+        for (const MockTarget &t : targets) {
+            // Without target selection (tg 0), any target that knows the
+            // request may answer it
+            if (tg && t.data[0] != tg) {
+                continue;
+            }
+            for (const MockExchange &x : t.exchanges) {
+                if (x.req.size() != sendlen || memcmp(x.req.data(), send, sendlen)) {
+                    continue;
+                }
+                if (x.res.empty()) {
+                    break;
+                }
+                take_us(x.delay_us ? x.delay_us : exchange_us);
+
+                uint8_t len = x.res.size();
+                if (len > *reslen) {
+                    len = *reslen;
+                }
+                memcpy(res, x.res.data(), len);
+                *reslen = len;
+                return true;
+            }
+        }
+    }
+
+    stats.failed++;
+    take_us(timeout_us);
+    return false;
+}
+
+uint8_t MockPN532::autopoll(uint8_t *buf, uint8_t buflen) {
+    busy_us = 0;
+    stats.autopolls++;
+    uint8_t found;
+    if (autopoll_hook) {
+        found = autopoll_hook(buf, buflen);
+    } else {
+        found = do_autopoll(host_now_us(), buf, buflen);
+    }
+    host_advance_us(busy_us);
+    return found;
+}
+
+bool MockPN532::exchange(const uint8_t *send, uint8_t sendlen, uint8_t *res, uint8_t *reslen) {
+    busy_us = 0;
+    bool ok = do_exchange(0, send, sendlen, res, reslen);
+    host_advance_us(busy_us);
+    return ok;
+}
+
+/*
+ * The SPI interface, using the PN532 frame format:
+ *
+ *      00 00 ff LEN LCS TFI PD0..PDn DCS 00
+ *
+ * The first byte of each transfer selects a data write, a status read or a
+ * data read.  Each command is acknowledged, and its response is only ready
+ * once the operation would have finished.
+ *
+ * The outcome of a scripted InAutoPoll is only settled once it is due, so
+ * that a card presented while the poll is running is still found by it.
+ */
+
+static const uint8_t ack_frame[] = {0x00, 0x00, 0xff, 0x00, 0xff, 0x00};
+
+// How many bytes of an InAutoPoll result hold the found targets
+static size_t buflen_of(const uint8_t *buf, uint8_t found) {
+    size_t pos = 0;
+    while (found--) {
+        pos += 2 + buf[pos + 1];
+    }
+    return pos;
+}
+
+void MockPN532::host_select(bool selected) {
+    if (faulted(host_now_us())) {
+        spi_first = true;
+        return;
+    }
+    if (selected) {
+        spi_first = true;
+        spi_in.clear();
+        spi_out.clear();
+        spi_out_pos = 0;
+        return;
+    }
+
+    if (!spi_first && spi_op == PN532_SPI_DATAWRITE) {
+        frame_received();
+    }
+}
+
+uint8_t MockPN532::host_transfer(uint8_t data) {
+    uint64_t now = host_now_us();
+
+    if (faulted(now)) {
+        // Nothing drives MISO, and the status never shows ready
+        return 0;
+    }
+
+    if (spi_first) {
+        spi_first = false;
+        spi_op = data;
+
+        if (spi_op == PN532_SPI_DATAREAD) {
+            // The data read is the ACK if that is waiting, else the response
+            if (ack_ready) {
+                spi_out.assign(ack_frame, ack_frame + sizeof(ack_frame));
+                ack_ready = false;
+            } else if (response_ready(now)) {
+                spi_out = response;
+                response_pending = false;
+            }
+        }
+        return 0xff;
+    }
+
+    switch (spi_op) {
+        case PN532_SPI_DATAWRITE:
+            spi_in.push_back(data);
+            return 0xff;
+        case PN532_SPI_STATREAD:
+            if (ack_ready || response_ready(now)) {
+                return PN532_SPI_READY;
+            }
+            return 0;
+        case PN532_SPI_DATAREAD:
+            if (spi_out_pos < spi_out.size()) {
+                return spi_out[spi_out_pos++];
+            }
+            return 0;
+    }
+    return 0xff;
+}
+
+void MockPN532::frame_received(void) {
+    stats.frames++;
+
+    std::vector<uint8_t> &f = spi_in;
+    size_t pos = 0;
+    while (pos + 1 < f.size() && !(f[pos] == 0x00 && f[pos + 1] == 0xff)) {
+        pos++;
+    }
+    pos += 2;
+
+    if (pos + 2 <= f.size() && f[pos] == 0x00 && f[pos + 1] == 0xff) {
+        // An ACK from the host aborts the current command
+        response_pending = false;
+        autopoll_pending = false;
+        ack_ready = false;
+        return;
+    }
+
+    if (pos + 2 > f.size() || (uint8_t)(f[pos] + f[pos + 1]) != 0) {
+        stats.bad_frames++;
+        return;
+    }
+    uint8_t len = f[pos];
+    pos += 2;
+    if (pos + len + 1 > f.size() || f[pos] != PN532_HOSTTOPN532) {
+        stats.bad_frames++;
+        return;
+    }
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i <= len; i++) {
+        sum += f[pos + i];
+    }
+    if (sum != 0) {
+        stats.bad_frames++;
+        return;
+    }
+
+    ack_ready = true;
+    command(&f[pos + 1], len - 1);
+}
+
+bool MockPN532::response_ready(uint64_t now) {
+    if (autopoll_pending) {
+        uint8_t buf[255];
+        busy_us = ack_us;
+        uint8_t found = do_autopoll(autopoll_start_us, buf, sizeof(buf));
+        if (now < autopoll_start_us + busy_us) {
+            return false;
+        }
+
+        autopoll_pending = false;
+        std::vector<uint8_t> data = {PN532_COMMAND_INAUTOPOLL + 1, found};
+        data.insert(data.end(), buf, buf + buflen_of(buf, found));
+        set_response(data);
+        ready_us = autopoll_start_us + busy_us;
+    }
+    return response_pending && now >= ready_us;
+}
+
+void MockPN532::command(const uint8_t *cmd, uint8_t cmdlen) {
+    std::vector<uint8_t> data;
+    uint8_t buf[255];
+    uint8_t buflen = sizeof(buf);
+    uint64_t now = host_now_us();
+
+    busy_us = ack_us;
+
+    if (!configured && cmd[0] != PN532_COMMAND_GETFIRMWAREVERSION &&
+        cmd[0] != PN532_COMMAND_SAMCONFIGURATION) {
+        // The syntax error frame
+        stats.refused++;
+        response = {0x00, 0x00, 0xff, 0x01, 0xff, 0x7f, 0x81, 0x00};
+        response_pending = true;
+        ready_us = now + busy_us;
+        return;
+    }
+
+    data.push_back(cmd[0] + 1);
+
+    switch (cmd[0]) {
+        case PN532_COMMAND_SAMCONFIGURATION:
+            stats.configs++;
+            configured = true;
+            break;
+        case PN532_COMMAND_GETFIRMWAREVERSION:
+            data.insert(data.end(), {0x32, 0x01, 0x06, 0x07});
+            break;
+        case PN532_COMMAND_INAUTOPOLL:
+            // The poll parameters are ignored, we always poll for everything
+            stats.autopolls++;
+            if (!autopoll_hook) {
+                autopoll_pending = true;
+                autopoll_start_us = now;
+                return;
+            }
+            buflen = autopoll_hook(buf, buflen);
+            data.push_back(buflen);
+            data.insert(data.end(), buf, buf + buflen_of(buf, buflen));
+            break;
+        case PN532_COMMAND_INDATAEXCHANGE:
+            if (cmdlen < 2) {
+                data.push_back(0x27);   // Not acceptable
+                break;
+            }
+            if (do_exchange(cmd[1], &cmd[2], cmdlen - 2, buf, &buflen)) {
+                data.push_back(0x00);
+                data.insert(data.end(), buf, buf + buflen);
+            } else {
+                data.push_back(0x01);   // Timeout
+            }
+            break;
+    }
+
+    set_response(data);
+    ready_us = now + busy_us;
+}
+
+void MockPN532::set_response(const std::vector<uint8_t> &data) {
+    uint8_t len = data.size() + 1;
+    uint8_t sum = PN532_PN532TOHOST;
+    response = {0x00, 0x00, 0xff, len, (uint8_t)-len, PN532_PN532TOHOST};
+    for (uint8_t ch : data) {
+        response.push_back(ch);
+        sum += ch;
+    }
+    response.push_back(-sum);
+    response.push_back(0x00);
+    response_pending = true;
+}
+
+/*
+ * The library interface
+ */
+
+Adafruit_PN532::Adafruit_PN532(uint8_t ss) {
+    // A pin with no simulated chip behaves as if nothing is fitted
+    chip = mock_pn532_find(ss);
+}
+
+void Adafruit_PN532::begin(void) {
+}
+
+uint32_t Adafruit_PN532::getFirmwareVersion(void) {
+    if (!chip) {
+        return 0;
+    }
+    // PN532, firmware 1.6, all features
+    return 0x32010607;
+}
+
+bool Adafruit_PN532::SAMConfig(void) {
+    return true;
+}
+
+uint8_t Adafruit_PN532::inAutoPoll(uint8_t *buf, uint8_t buflen) {
+    return chip->autopoll(buf, buflen);
+}
+
+bool Adafruit_PN532::inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength) {
+    return chip->exchange(send, sendLength, response, responseLength);
+}
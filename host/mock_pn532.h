@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A simulated PN532, driven by scripted card profiles.
+ *
+ * A profile is the list of targets that InAutoPoll would report, each with
+ * the InDataExchange request/response pairs that the card answers.  Every
+ * operation takes a configurable amount of virtual time.
+ *
+ * The chip can be used in two ways:
+ * - through the Adafruit_PN532 library calls, which block (advancing the
+ *   virtual clock) until the operation is done, just like the real library
+ * - through SPI, where it understands the PN532 frames, answers the status
+ *   reads and only makes its response ready once the operation is done
+ */
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+#include <SPI.h>
+
+struct MockExchange {
+    std::vector<uint8_t> req;
+    std::vector<uint8_t> res;   // An empty response makes the exchange fail
+    uint32_t delay_us;          // Zero uses the chip default exchange_us
+};
+
+struct MockTarget {
+    uint8_t type;               // The InAutoPoll target type
+    std::vector<uint8_t> data;  // The InAutoPoll target data, starting at Tg
+    std::vector<MockExchange> exchanges;
+};
+
+struct MockStats {
+    uint32_t autopolls;
+    uint32_t exchanges;
+    uint32_t failed;
+    uint32_t frames;            // Command frames received over SPI
+    uint32_t bad_frames;
+    uint32_t configs;           // SAMConfiguration commands
+    uint32_t refused;           // Commands refused while unconfigured
+};
+
+class MockPN532 : public HostSPIDevice {
+    public:
+        MockPN532(uint8_t ss);
+
+        // An InAutoPoll that finds nothing runs for the whole poll period
+        uint32_t poll_empty_us = 150000;
+        // InAutoPoll sweeps through the card types at this interval
+        uint32_t poll_sweep_us = 30000;
+        // Time from a sweep finding a card to InAutoPoll returning it
+        uint32_t poll_found_us = 15000;
+        // Default cost of one InDataExchange round trip
+        uint32_t exchange_us = 5000;
+        // Cost of an InDataExchange that the card never answers
+        uint32_t timeout_us = 50000;
+        // Time to check and acknowledge a command frame
+        uint32_t ack_us = 500;
+
+        MockStats stats = {};
+
+        // When set, these answer the library calls instead of the scripted
+        // targets (for example, when replaying a captured trace).  They
+        // can use take_us() to say how long the operation took.
+        std::function<uint8_t(uint8_t *buf, uint8_t buflen)> autopoll_hook;
+        std::function<bool(const uint8_t *send, uint8_t sendlen, uint8_t *res, uint8_t *reslen)> exchange_hook;
+
+        // Place the targets into the field at the given virtual time
+        void present(const std::vector<MockTarget> &targets, uint64_t when_us);
+
+        // Take all targets out of the field at the given virtual time
+        void remove(uint64_t when_us);
+
+        // Stop answering between the given virtual times.  With reset set,
+        // it is as if the power was lost, so the command it was running is
+        // forgotten and it comes back needing a SAMConfiguration before it
+        // will do anything else.  Otherwise it has just hung for a while.
+        void fault(uint64_t from_us, uint64_t until_us, bool reset);
+
+        // Add to the time taken by the current operation
+        void take_us(uint64_t us) { busy_us += us; }
+
+        // Implementations of the library calls
+        uint8_t autopoll(uint8_t *buf, uint8_t buflen);
+        bool exchange(const uint8_t *send, uint8_t sendlen, uint8_t *res, uint8_t *reslen);
+
+        // The SPI interface
+        void host_select(bool selected) override;
+        uint8_t host_transfer(uint8_t data) override;
+
+    private:
+        std::vector<MockTarget> targets;
+        uint64_t present_us = 0;
+        uint64_t remove_us = 0;
+        uint64_t busy_us = 0;
+        uint64_t fault_from_us = UINT64_MAX;
+        uint64_t fault_until_us = 0;
+        bool fault_reset = false;
+        bool configured = true;
+
+        bool in_field(uint64_t when_us);
+        bool faulted(uint64_t now);
+        uint8_t do_autopoll(uint64_t start_us, uint8_t *buf, uint8_t buflen);
+        bool do_exchange(uint8_t tg, const uint8_t *send, uint8_t sendlen, uint8_t *res, uint8_t *reslen);
+
+        // SPI state
+        uint8_t spi_op;
+        bool spi_first;
+        std::vector<uint8_t> spi_in;
+        std::vector<uint8_t> spi_out;
+        size_t spi_out_pos;
+        bool ack_ready = false;
+        bool response_pending = false;
+        uint64_t ready_us = 0;
+        std::vector<uint8_t> response;
+        bool autopoll_pending = false;
+        uint64_t autopoll_start_us;
+
+        void frame_received(void);
+        void command(const uint8_t *cmd, uint8_t cmdlen);
+        void set_response(const std::vector<uint8_t> &data);
+        bool response_ready(uint64_t now);
+};
+
+// Find (creating if needed) the simulated chip attached to an SS pin
+MockPN532 &mock_pn532(uint8_t ss);
+
+// Find the simulated chip attached to an SS pin, or NULL if there is none
+MockPN532 *mock_pn532_find(uint8_t ss);
@@ -0,0 +1,302 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Scripted card profiles for the simulated PN532, one for each card family
+ * that the sketch knows how to decode.
+ *
+ * The UIDs and serial numbers are made up, but the shape of each exchange
+ * matches what the real cards answer.
+ */
+
+#include "arduino_cardreader.h"
+#include "profiles.h"
+
+std::vector<uint8_t> target_iso14443a(
+    uint8_t tg,
+    uint16_t atqa,
+    uint8_t sak,
+    const std::vector<uint8_t> &uid,
+    const std::vector<uint8_t> &ats
+) {
+    std::vector<uint8_t> data = {
+        tg,
+        (uint8_t)(atqa >> 8),
+        (uint8_t)(atqa & 0xff),
+        sak,
+        (uint8_t)uid.size(),
+    };
+    data.insert(data.end(), uid.begin(), uid.end());
+    data.insert(data.end(), ats.begin(), ats.end());
+    return data;
+}
+
+std::vector<uint8_t> target_felica(
+    uint8_t tg,
+    const std::vector<uint8_t> &idm,
+    const std::vector<uint8_t> &pmm
+) {
+    std::vector<uint8_t> data = {tg, 0x12, 0x01};
+    data.insert(data.end(), idm.begin(), idm.end());
+    data.insert(data.end(), pmm.begin(), pmm.end());
+    return data;
+}
+
+// A FeliCa Read Without Encryption of one block from one service
+static std::vector<uint8_t> felica_read(const std::vector<uint8_t> &idm, uint16_t service, uint8_t block) {
+    std::vector<uint8_t> cmd = {16, 0x06};
+    cmd.insert(cmd.end(), idm.begin(), idm.end());
+    cmd.insert(cmd.end(), {1, (uint8_t)(service & 0xff), (uint8_t)(service >> 8), 1, 0x80, block});
+    return cmd;
+}
+
+// The answer to felica_read(), with the given status flags and block data
+static std::vector<uint8_t> felica_block(const std::vector<uint8_t> &idm, uint8_t sf1, uint8_t sf2, const std::vector<uint8_t> &block) {
+    std::vector<uint8_t> res = {0, 0x07};
+    res.insert(res.end(), idm.begin(), idm.end());
+    res.insert(res.end(), {sf1, sf2});
+    if (sf1 == 0) {
+        res.push_back(1);
+        res.insert(res.end(), block.begin(), block.end());
+    }
+    res[0] = res.size();
+    return res;
+}
+
+static const std::vector<uint8_t> idm_edy = {0x01, 0x2e, 0x4c, 0x11, 0x0a, 0x17, 0x33, 0x05};
+static const std::vector<uint8_t> idm_nanaco = {0x01, 0x2e, 0x3d, 0x9f, 0x52, 0x14, 0x20, 0x8b};
+static const std::vector<uint8_t> idm_lite = {0x01, 0x2e, 0x5a, 0x0c, 0x88, 0x31, 0x07, 0x42};
+
+// The PMm of a mobile style FeliCa chip, and of a FeliCa Lite-S
+static const std::vector<uint8_t> pmm_standard = {0x03, 0x01, 0x4b, 0x02, 0x4f, 0x49, 0x93, 0xff};
+static const std::vector<uint8_t> pmm_lite_s = {0x00, 0xf1, 0x00, 0x00, 0x00, 0x01, 0x43, 0x00};
+
+// The Get Application IDs answer for a card with many apps, which needs a
+// continuation frame, and where the one we know about is in the last frame
+static std::vector<uint8_t> apps_frame(uint8_t status, uint8_t first, uint8_t count) {
+    std::vector<uint8_t> res = {status};
+    for (uint8_t i = 0; i < count; i++) {
+        res.insert(res.end(), {0xf0, 0x20, (uint8_t)(first + i)});
+    }
+    return res;
+}
+
+static std::vector<uint8_t> apps_last_frame(void) {
+    std::vector<uint8_t> res = apps_frame(0x00, 19, 3);
+    res.insert(res.end(), {0x31, 0x45, 0x53});
+    return res;
+}
+
+// A DESFire EV1 ATS, as sent by all of the DESFire based transit cards
+static const std::vector<uint8_t> ats_desfire = {0x06, 0x75, 0x77, 0x81, 0x02, 0x80};
+
+const std::vector<Profile> profiles = {
+    {
+        "uid",
+        {{
+            TYPE_MIFARE,
+            target_iso14443a(1, 0x0004, 0x08, {0xe2, 0xe2, 0xf9, 0x8b}, {}),
+            {},
+        }},
+    },
+    {
+        "hsl",
+        {{
+            TYPE_MIFARE,
+            target_iso14443a(1, 0x0044, 0x00, {0x04, 0x51, 0x23, 0x8a, 0x19, 0x64, 0x80}, {}),
+            {
+                {
+                    {MIFARE_CMD_READ, 4},
+                    {
+                        0x01, 0x92, 0x46, 0x21, 0x00, 0x12, 0x80, 0x00,
+                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                    },
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        "troika",
+        {{
+            TYPE_MIFARE,
+            target_iso14443a(1, 0x0044, 0x00, {0x04, 0x7a, 0x31, 0x52, 0x9c, 0x40, 0x81}, {}),
+            {
+                {
+                    {MIFARE_CMD_READ, 4},
+                    {
+                        0x45, 0xdb, 0x1e, 0x35, 0x2c, 0x9f, 0x60, 0x00,
+                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                    },
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        "opal",
+        {{
+            TYPE_ISO14443A,
+            target_iso14443a(1, 0x0344, 0x20, {0x04, 0x35, 0x17, 0x8a, 0x59, 0x75, 0x32}, ats_desfire),
+            {
+                {{0x6a}, {0x00, 0x31, 0x45, 0x53}, 0},
+                {{0x5a, 0x31, 0x45, 0x53}, {0x00}, 0},
+                {
+                    {0xbd, 0x07, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00},
+                    {0x00, 0x15, 0xcd, 0x5b, 0x07, 0x02},
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        "myki",
+        {{
+            TYPE_ISO14443A,
+            target_iso14443a(1, 0x0344, 0x20, {0x04, 0x22, 0x6e, 0x12, 0x3a, 0x5c, 0x80}, ats_desfire),
+            {
+                {{0x6a}, {0x00, 0x00, 0x11, 0xf2, 0xf0, 0x10, 0xf2}, 0},
+                {{0x5a, 0x00, 0x11, 0xf2}, {0x00}, 0},
+                {
+                    {0xbd, 0x0f, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00},
+                    {0x00, 0xc9, 0xb4, 0x04, 0x00, 0x4e, 0x61, 0xbc, 0x00},
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        "clipper",
+        {{
+            TYPE_ISO14443A,
+            target_iso14443a(1, 0x0344, 0x20, {0x04, 0x4b, 0x0c, 0x72, 0x81, 0x2d, 0x80}, ats_desfire),
+            {
+                {{0x6a}, {0x00, 0x90, 0x11, 0xf2}, 0},
+                {{0x5a, 0x90, 0x11, 0xf2}, {0x00}, 0},
+                {
+                    {0xbd, 0x08, 0x01, 0x00, 0x00, 0x04, 0x00, 0x00},
+                    {0x00, 0x49, 0x96, 0x02, 0xd2},
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        "multiapp",
+        {{
+            TYPE_ISO14443A,
+            target_iso14443a(1, 0x0344, 0x20, {0x04, 0x61, 0x0a, 0x2b, 0x3c, 0x4d, 0x80}, ats_desfire),
+            {
+                {{0x6a}, apps_frame(0xaf, 0, 19), 0},
+                {{0xaf}, apps_last_frame(), 0},
+                {{0x5a, 0x31, 0x45, 0x53}, {0x00}, 0},
+                {
+                    {0xbd, 0x07, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00},
+                    {0x00, 0x2a, 0x61, 0x19, 0x00, 0x04},
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        // An ISO14443-4 card that is not a DESFire, and answers the DESFire
+        // commands with a 7816 "length error"
+        "other",
+        {{
+            TYPE_ISO14443A,
+            target_iso14443a(1, 0x0044, 0x20, {0x04, 0x58, 0x3e, 0x6a, 0x21, 0x47, 0x80}, {0x05, 0x72, 0x80, 0x40, 0x00}),
+            {
+                {{0x6a}, {0x67, 0x00}, 0},
+            },
+        }},
+    },
+    {
+        // FeliCa cards, read without any keys
+        "edy",
+        {{
+            TYPE_FELICA_212,
+            target_felica(1, idm_edy, pmm_standard),
+            {
+                {
+                    felica_read(idm_edy, 0x110b, 0),
+                    felica_block(idm_edy, 0x00, 0x00, {
+                        0x00, 0x00, 0x21, 0x10, 0x08, 0x40, 0x55, 0x12,
+                        0x34, 0x56, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                    }),
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        "nanaco",
+        {{
+            TYPE_FELICA_212,
+            target_felica(1, idm_nanaco, pmm_standard),
+            {
+                // Not an Edy card, so that service is missing
+                {felica_read(idm_nanaco, 0x110b, 0), felica_block(idm_nanaco, 0x01, 0xa6, {}), 0},
+                {
+                    felica_read(idm_nanaco, 0x558b, 0),
+                    felica_block(idm_nanaco, 0x00, 0x00, {
+                        0x71, 0x02, 0x00, 0x13, 0x57, 0x92, 0x46, 0x80,
+                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                    }),
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        "lite",
+        {{
+            TYPE_FELICA_212,
+            target_felica(1, idm_lite, pmm_lite_s),
+            {
+                {
+                    felica_read(idm_lite, 0x000b, 0x82),
+                    felica_block(idm_lite, 0x00, 0x00, {
+                        0x01, 0x2e, 0x5a, 0x0c, 0x88, 0x31, 0x07, 0x42,
+                        0x00, 0x3c, 0x20, 0x24, 0x10, 0x17, 0x00, 0x05,
+                    }),
+                    0,
+                },
+            },
+        }},
+    },
+    {
+        // A payment style card, which has no master file to select and
+        // sends its answers in pieces
+        "iso7816",
+        {{
+            TYPE_ISO14443A,
+            target_iso14443a(
+                1, 0x0004, 0x20, {0x08, 0x3f, 0x12, 0x9a},
+                {
+                    0x10, 0x78, 0x80, 0x70, 0x02, 0x80, 0x31, 0x80,
+                    0x66, 0xb0, 0x84, 0x12, 0x01, 0x6e, 0x01, 0x83,
+                }
+            ),
+            {
+                {{0x00, 0xa4, 0x00, 0x00, 0x00}, {0x6a, 0x82}, 0},
+                {
+                    {
+                        0x00, 0xa4, 0x04, 0x00, 0x0e,
+                        '1', 'P', 'A', 'Y', '.', 'S', 'Y', 'S', '.', 'D', 'D', 'F', '0', '1',
+                    },
+                    {0x61, 0x08},
+                    0,
+                },
+                {
+                    {0x00, 0xc0, 0x00, 0x00, 0x08},
+                    {0x6f, 0x06, 0x84, 0x04, 0x31, 0x50, 0x41, 0x59, 0x90, 0x00},
+                    0,
+                },
+                {{0x00, 0xb0, 0x95, 0x00, 0x00}, {0x6c, 0x04}, 0},
+                {{0x00, 0xb0, 0x95, 0x00, 0x04}, {0x01, 0x02, 0x03, 0x04, 0x90, 0x00}, 0},
+                {{0x00, 0xb2, 0x01, 0x02, 0x00, 0x00}, {0x6a, 0x83}, 0},
+                {{0x80, 0x5c, 0x00, 0x02, 0x04, 0x00}, {0x6d, 0x00}, 0},
+            },
+        }},
+    },
+};
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Scripted card profiles for the simulated PN532, one for each card family
+ * that the sketch knows how to decode.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mock_pn532.h"
+
+struct Profile {
+    std::string name;
+    std::vector<MockTarget> targets;
+};
+
+extern const std::vector<Profile> profiles;
+
+// Build the InAutoPoll target data for an ISO14443A (or mifare) target
+std::vector<uint8_t> target_iso14443a(
+    uint8_t tg,
+    uint16_t atqa,
+    uint8_t sak,
+    const std::vector<uint8_t> &uid,
+    const std::vector<uint8_t> &ats
+);
+
+// Build the InAutoPoll target data for a FeliCa target
+std::vector<uint8_t> target_felica(
+    uint8_t tg,
+    const std::vector<uint8_t> &idm,
+    const std::vector<uint8_t> &pmm
+);
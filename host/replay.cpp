@@ -0,0 +1,437 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Replay captured PN532 traces (see trace.h) through the host build of the
+ * sketch.
+ *
+ * The input is either a binary trace file or a serial log containing the
+ * trace= messages from a device with capture enabled.  The sketch runs with
+ * its simulated PN532 answering from the trace, so the decoders see exactly
+ * what the real cards sent.  Replay is deterministic and runs as fast as the
+ * host can manage, which makes a corpus of real taps usable both as a
+ * throughput benchmark and, by comparing the output, as a regression test.
+ */
+
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "mock_pn532.h"
+#include "trace.h"
+
+void setup(void);
+void loop(void);
+
+#define PN532_SS   (10)
+
+struct Record {
+    uint8_t type;
+    uint32_t timestamp;
+    uint32_t duration_us;
+    uint8_t found;      // TRACE_AUTOPOLL
+    uint8_t tg;         // TRACE_EXCHANGE
+    bool ok;            // TRACE_EXCHANGE
+    std::vector<uint8_t> cmd;
+    std::vector<uint8_t> res;   // The poll data, for TRACE_AUTOPOLL
+};
+
+static bool get_bytes(const std::vector<uint8_t> &buf, size_t &pos, size_t len, std::vector<uint8_t> &out) {
+    if (pos + len > buf.size()) {
+        return false;
+    }
+    out.assign(buf.begin() + pos, buf.begin() + pos + len);
+    pos += len;
+    return true;
+}
+
+// Parse a run of concatenated records, returning false on a short record
+static bool parse_records(const std::vector<uint8_t> &buf, std::vector<Record> &records) {
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        if (pos + TRACE_HEADER_SIZE > buf.size()) {
+            return false;
+        }
+
+        Record r = {};
+        uint8_t len;
+        r.type = buf[pos];
+        r.timestamp = buf[pos + 1] | buf[pos + 2] << 8 | buf[pos + 3] << 16 | (uint32_t)buf[pos + 4] << 24;
+        r.duration_us = (buf[pos + 5] | buf[pos + 6] << 8) * TRACE_DURATION_US;
+        pos += TRACE_HEADER_SIZE;
+
+        switch (r.type) {
+            case TRACE_AUTOPOLL:
+                if (pos + 2 > buf.size()) {
+                    return false;
+                }
+                r.found = buf[pos++];
+                len = buf[pos++];
+                if (!get_bytes(buf, pos, len, r.res)) {
+                    return false;
+                }
+                break;
+            case TRACE_EXCHANGE:
+                if (pos + 3 > buf.size()) {
+                    return false;
+                }
+                r.tg = buf[pos++];
+                r.ok = buf[pos++];
+                len = buf[pos++];
+                if (!get_bytes(buf, pos, len, r.cmd)) {
+                    return false;
+                }
+                if (pos + 1 > buf.size()) {
+                    return false;
+                }
+                len = buf[pos++];
+                if (!get_bytes(buf, pos, len, r.res)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        records.push_back(r);
+    }
+    return true;
+}
+
+static int hexval(int ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    return -1;
+}
+
+// Pull the records out of each trace= message in a serial log
+static bool parse_log(const std::vector<uint8_t> &log, std::vector<Record> &records) {
+    static const std::string key = "\x02trace=";
+
+    std::string text(log.begin(), log.end());
+    size_t pos = 0;
+    while ((pos = text.find(key, pos)) != std::string::npos) {
+        pos += key.size();
+        size_t end = text.find('\x04', pos);
+        if (end == std::string::npos) {
+            break;
+        }
+
+        std::vector<uint8_t> record;
+        for (size_t i = pos; i + 1 < end; i += 2) {
+            int hi = hexval(text[i]);
+            int lo = hexval(text[i + 1]);
+            if (hi < 0 || lo < 0) {
+                return false;
+            }
+            record.push_back(hi << 4 | lo);
+        }
+        if (!parse_records(record, records)) {
+            return false;
+        }
+        pos = end;
+    }
+    return true;
+}
+
+static bool load(const char *filename, std::vector<Record> &records) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+
+    std::vector<uint8_t> buf;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        buf.insert(buf.end(), chunk, chunk + n);
+    }
+    fclose(f);
+
+    bool ok;
+    if (buf.size() >= 5 && memcmp(buf.data(), TRACE_MAGIC, 4) == 0) {
+        if (buf[4] != TRACE_VERSION) {
+            fprintf(stderr, "%s: unsupported trace version %i\n", filename, buf[4]);
+            return false;
+        }
+        buf.erase(buf.begin(), buf.begin() + 5);
+        ok = parse_records(buf, records);
+    } else {
+        ok = parse_log(buf, records);
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: malformed trace record\n", filename);
+    }
+    return ok;
+}
+
+static bool save(const char *filename, const std::vector<Record> &records) {
+    std::vector<uint8_t> buf(TRACE_MAGIC, TRACE_MAGIC + 4);
+    buf.push_back(TRACE_VERSION);
+
+    for (const Record &r : records) {
+        uint32_t duration = r.duration_us / TRACE_DURATION_US;
+        uint8_t header[TRACE_HEADER_SIZE] = {
+            r.type,
+            (uint8_t)r.timestamp,
+            (uint8_t)(r.timestamp >> 8),
+            (uint8_t)(r.timestamp >> 16),
+            (uint8_t)(r.timestamp >> 24),
+            (uint8_t)duration,
+            (uint8_t)(duration >> 8),
+        };
+        buf.insert(buf.end(), header, header + sizeof(header));
+
+        if (r.type == TRACE_AUTOPOLL) {
+            buf.push_back(r.found);
+        } else {
+            buf.push_back(r.tg);
+            buf.push_back(r.ok);
+            buf.push_back(r.cmd.size());
+            buf.insert(buf.end(), r.cmd.begin(), r.cmd.end());
+        }
+        buf.push_back(r.res.size());
+        buf.insert(buf.end(), r.res.begin(), r.res.end());
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+    fwrite(buf.data(), 1, buf.size(), f);
+    fclose(f);
+    return true;
+}
+
+// Feeds the records to the simulated PN532, in order
+struct Replay {
+    const std::vector<Record> *records;
+    MockPN532 *chip;
+    size_t pos;
+    bool done;
+
+    // Keeps virtual time in step with the recorded timestamps, so that
+    // anything timing dependent in the sketch behaves as it did
+    bool have_base;
+    uint64_t base_us;
+    uint32_t base_ts;
+
+    // The last poll returned, if it found nothing, which is repeated until
+    // the next record is due
+    const Record *empty;
+
+    uint32_t polls;
+    uint32_t taps;
+    uint32_t exchanges;
+    uint32_t divergent;
+
+    void advance_to(const Record &r) {
+        if (!have_base) {
+            have_base = true;
+            base_us = host_now_us();
+            base_ts = r.timestamp;
+        }
+        uint64_t when = base_us + (uint32_t)(r.timestamp - base_ts) + r.duration_us;
+        if (when > host_now_us()) {
+            chip->take_us(when - host_now_us());
+        }
+    }
+
+    // When the record started, in virtual time
+    uint64_t start_of(const Record &r) {
+        return base_us + (uint32_t)(r.timestamp - base_ts);
+    }
+
+    uint8_t autopoll(uint8_t *buf, uint8_t buflen) {
+        // Consecutive empty polls are only recorded once, but the sketch
+        // still needs to see them, for example to notice a card leaving
+        if (empty && pos < records->size() && start_of((*records)[pos]) > host_now_us()) {
+            uint64_t until = start_of((*records)[pos]);
+            uint64_t us = empty->duration_us ? empty->duration_us : 1000;
+            if (host_now_us() + us > until) {
+                us = until - host_now_us();
+            }
+            chip->take_us(us);
+            polls++;
+            return 0;
+        }
+        empty = NULL;
+
+        // Skip any exchanges that the sketch did not ask for this time
+        while (pos < records->size() && (*records)[pos].type != TRACE_AUTOPOLL) {
+            divergent++;
+            pos++;
+        }
+        if (pos >= records->size()) {
+            done = true;
+            return 0;
+        }
+
+        const Record &r = (*records)[pos++];
+        advance_to(r);
+        polls++;
+
+        if (r.res.size() > buflen) {
+            return 0;
+        }
+        memcpy(buf, r.res.data(), r.res.size());
+        if (r.found) {
+            taps++;
+        } else {
+            empty = &r;
+        }
+        return r.found;
+    }
+
+    bool exchange(const uint8_t *send, uint8_t sendlen, uint8_t *res, uint8_t *reslen) {
+        exchanges++;
+        if (pos >= records->size() || (*records)[pos].type != TRACE_EXCHANGE) {
+            divergent++;
+            return false;
+        }
+
+        const Record &r = (*records)[pos++];
+        advance_to(r);
+
+        if (r.cmd.size() != sendlen || memcmp(r.cmd.data(), send, sendlen)) {
+            divergent++;
+            return false;
+        }
+        if (!r.ok) {
+            return false;
+        }
+
+        uint8_t len = r.res.size();
+        if (len > *reslen) {
+            len = *reslen;
+        }
+        memcpy(res, r.res.data(), len);
+        *reslen = len;
+        return true;
+    }
+};
+
+struct Output {
+    bool quiet;
+    uint32_t hash;
+};
+
+static void output_tx(uint8_t ch, uint64_t /* done_us */, void *arg) {
+    Output *out = (Output *)arg;
+    if (!out->quiet) {
+        putchar(ch);
+    }
+    // FNV-1a, as a cheap fingerprint of everything the sketch sent
+    out->hash = (out->hash ^ ch) * 16777619;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] trace...\n"
+        "\n"
+        "  -n, --repeat N         replay the traces N times (default 1)\n"
+        "  -q, --quiet            do not copy the sketch serial output to stdout\n"
+        "  -w, --write FILE       save the loaded records as a binary trace file\n",
+        argv0
+    );
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"repeat",  required_argument, NULL, 'n'},
+        {"quiet",   no_argument,       NULL, 'q'},
+        {"write",   required_argument, NULL, 'w'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    uint32_t repeat = 1;
+    const char *write_file = NULL;
+    Output out = {false, 2166136261};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:qw:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                repeat = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                out.quiet = true;
+                break;
+            case 'w':
+                write_file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Record> records;
+    for (int i = optind; i < argc; i++) {
+        if (!load(argv[i], records)) {
+            return 1;
+        }
+    }
+    if (write_file && !save(write_file, records)) {
+        return 1;
+    }
+
+    Replay replay = {};
+    MockPN532 &chip = mock_pn532(PN532_SS);
+    replay.records = &records;
+    replay.chip = &chip;
+
+    chip.autopoll_hook = [&](uint8_t *buf, uint8_t buflen) {
+        return replay.autopoll(buf, buflen);
+    };
+    chip.exchange_hook = [&](const uint8_t *send, uint8_t sendlen, uint8_t *res, uint8_t *reslen) {
+        return replay.exchange(send, sendlen, res, reslen);
+    };
+
+    Serial.host_set_tx_hook(output_tx, &out);
+    setup();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < repeat; i++) {
+        replay.pos = 0;
+        replay.done = false;
+        replay.have_base = false;
+        replay.empty = NULL;
+        while (!replay.done) {
+            loop();
+        }
+    }
+    Serial.flush();
+
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+
+    fprintf(stderr,
+        "records=%zu polls=%u taps=%u exchanges=%u divergent=%u\n"
+        "host_secs=%.3f taps_per_sec=%.0f exchanges_per_sec=%.0f\n"
+        "output_bytes=%llu output_fnv1a=%08x\n",
+        records.size(), replay.polls, replay.taps, replay.exchanges, replay.divergent,
+        secs, replay.taps / secs, replay.exchanges / secs,
+        (unsigned long long)Serial.host_tx_bytes(), out.hash
+    );
+
+    return replay.divergent ? 2 : 0;
+}
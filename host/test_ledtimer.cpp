@@ -0,0 +1,52 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Checks that an LED set for a duration turns off after it, for durations
+ * up to the largest that the L command can give.
+ */
+
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "ledtimer.h"
+
+#define LED_PIN 5
+
+// Returns the number of timer ticks that the LED stayed on for
+static uint32_t ticks_on(uint16_t duration_millis) {
+    // Start just after a tick, so each step below covers exactly one
+    host_advance_us(LEDTIMER_TICK_MILLIS * 1000 - host_now_us() % (LEDTIMER_TICK_MILLIS * 1000) + 1);
+
+    led_set(0, LED_MODE_ON, duration_millis);
+    uint32_t ticks = 0;
+    while (ticks <= 0x10000) {
+        host_advance_us(LEDTIMER_TICK_MILLIS * 1000);
+        if (!host_pin_state(LED_PIN)) {
+            break;
+        }
+        ticks++;
+    }
+    led_set(0, LED_MODE_OFF, 0);
+    return ticks;
+}
+
+int main(void) {
+    static const uint16_t durations[] = {1, 100, 101, 20000, 65435, 65436, 65500, 65535};
+    int failed = 0;
+
+    ledtimer_init();
+    led_attach(0, LED_PIN);
+
+    for (uint16_t duration : durations) {
+        uint32_t want = (duration + LEDTIMER_TICK_MILLIS - 1) / LEDTIMER_TICK_MILLIS;
+        uint32_t got = ticks_on(duration);
+        printf("%-4s duration_ms=%u ticks=%u want=%u\n",
+            got == want ? "ok" : "FAIL", duration, got, want);
+        if (got != want) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
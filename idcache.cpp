@@ -0,0 +1,89 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A small cache of the serials decoded from recently seen cards
+ */
+
+#include <Arduino.h>
+
+#include "card.h"
+#include "idcache.h"
+#include "packets.h"
+
+struct idcache_entry {
+    uint8_t uid_type;   // UID_TYPE_NONE for an unused entry
+    uint8_t uid_len;
+    uint8_t uid[8];
+    uint8_t info_type;
+    uint8_t info_len;
+    uint8_t info[sizeof(((Card *)0)->info)];
+};
+
+// Most recently used first
+static struct idcache_entry cache[IDCACHE_SIZE];
+static uint16_t hits;
+static uint16_t misses;
+
+static bool match(struct idcache_entry *e, Card& card) {
+    if (e->uid_type != card.uid_type || e->uid_len != card.uid_len) {
+        return false;
+    }
+    return memcmp(e->uid, card.uid, card.uid_len) == 0;
+}
+
+// Move the entry at index to the front, returning the front entry
+static struct idcache_entry *promote(uint8_t index) {
+    struct idcache_entry tmp = cache[index];
+    memmove(&cache[1], &cache[0], index * sizeof(cache[0]));
+    cache[0] = tmp;
+    return &cache[0];
+}
+
+bool idcache_lookup(Card& card) {
+    for (uint8_t i = 0; i < IDCACHE_SIZE; i++) {
+        if (cache[i].uid_type == UID_TYPE_NONE) {
+            break;
+        }
+        if (match(&cache[i], card)) {
+            struct idcache_entry *e = promote(i);
+            card.set_info_type(e->info_type);
+            card.info_len = e->info_len;
+            memcpy(card.info, e->info, sizeof(card.info));
+            hits++;
+            return true;
+        }
+    }
+    misses++;
+    return false;
+}
+
+void idcache_store(Card& card) {
+    uint8_t i;
+    for (i = 0; i < IDCACHE_SIZE - 1; i++) {
+        if (cache[i].uid_type == UID_TYPE_NONE || match(&cache[i], card)) {
+            break;
+        }
+    }
+    // Either the matching entry, the first free one or the least recent
+    struct idcache_entry *e = promote(i);
+
+    e->uid_type = card.uid_type;
+    e->uid_len = card.uid_len;
+    memcpy(e->uid, card.uid, card.uid_len);
+    e->info_type = card.info_type;
+    e->info_len = card.info_len;
+    memcpy(e->info, card.info, sizeof(e->info));
+}
+
+void idcache_print_stats(Print& p) {
+    packet_start(p);
+    p.print(F("cache="));
+    p.print(hits);
+    p.print(',');
+    p.print(misses);
+    packet_end(p);
+
+    hits = 0;
+    misses = 0;
+}
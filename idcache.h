@@ -0,0 +1,33 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A small cache of the serials decoded from recently seen cards, so that a
+ * card tapped again does not need to be read again.
+ *
+ * The cache is keyed by the uid type and UID, and holds the info_type and
+ * info decoded for that card.  A card that was fully read but had no
+ * decodable serial is stored as INFO_TYPE_NONE, so it is not read again
+ * either.  Failed reads (e.g. a card pulled away early) are never stored.
+ *
+ * The entries are kept in most recently used order, and the least recently
+ * used entry is replaced when the cache is full.
+ */
+#pragma once
+
+#include <Print.h>
+#include <stdint.h>
+#include "card.h"
+
+#ifndef IDCACHE_SIZE
+#define IDCACHE_SIZE    4
+#endif
+
+// Look up the card, filling in its info if found
+bool idcache_lookup(Card& card);
+
+// Remember the info decoded for the card
+void idcache_store(Card& card);
+
+// Send the cache= status message, then reset the counts
+void idcache_print_stats(Print& p);
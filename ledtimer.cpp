@@ -9,15 +9,29 @@
 #include <Arduino.h>
 #include "ledtimer.h"
 
-struct led_status led[2] = {
-    {
-        .pin = LED_BUILTIN,
-        .mode = LED_MODE_OFF,
-    },
-    {
-        .pin = LED_BUILTIN,
-        .mode = LED_MODE_OFF,
-    },
+static struct led_channel led[LEDTIMER_CHANNELS];
+
+// The step of the patterns that every channel is on, as a mask.  Taking it
+// from the shared tick keeps the channels in phase, so that BLINK1 and BLINK2
+// always alternate, whenever each one was set.
+static uint32_t step_mask = 1;
+
+// How long the last run of the ISR took, in timer counts, and whether that
+// has been collected yet
+static volatile uint8_t isr_counts;
+static volatile bool isr_ran;
+
+static uint32_t led_patterns[LED_MODES] = {
+    0,              // LED_MODE_OFF
+    0x55555555,     // LED_MODE_BLINK1
+    0xaaaaaaaa,     // LED_MODE_BLINK2
+    0x0f0f0f0f,     // Slow blink
+    0x00000005,     // Double flash
+    0,
+    0,
+    0,
+    0,
+    0xffffffff,     // LED_MODE_ON
 };
 
 void ledtimer_init() {
@@ -32,38 +46,106 @@ void ledtimer_init() {
     sei();
 }
 
-static void led_update(struct led_status *led) {
-    unsigned long now = millis();
-    if ((led->next_state_millis - now) & 0x80000000) {
-        // The next state is always "off"
-        led->mode == LED_MODE_OFF;
-        digitalWrite(led->pin, LOW);
+void led_attach(uint8_t nr, uint8_t pin) {
+    if (nr >= LEDTIMER_CHANNELS) {
         return;
     }
+    pinMode(pin, OUTPUT);
 
-    switch (led->mode) {
-        case LED_MODE_OFF:
-            digitalWrite(led->pin, LOW);
-            // off is off is off, so skip next state processing
-            return;
+    cli();
+    led[nr].port = portOutputRegister(digitalPinToPort(pin));
+    led[nr].mask = digitalPinToBitMask(pin);
+    sei();
+}
 
-        case LED_MODE_ON:
-            digitalWrite(led->pin, HIGH);
-            break;
+bool led_set(uint8_t nr, uint8_t mode, uint16_t duration_millis, uint8_t repeat) {
+    if (nr >= LEDTIMER_CHANNELS || mode >= LED_MODES) {
+        return false;
+    }
 
-        case LED_MODE_BLINK1:
-            digitalWrite(led->pin, (now & 0x40)?HIGH:LOW);
-            break;
+    // Round up, so that a short duration still shows for a tick.  This is
+    // done in 32 bits, as on the AVR the sum would wrap for anything over
+    // about 65.4 seconds and the LED would then stay on forever.
+    uint32_t ticks = 0;
+    if (duration_millis) {
+        ticks = ((uint32_t)duration_millis + LEDTIMER_TICK_MILLIS - 1) / LEDTIMER_TICK_MILLIS;
+        if (ticks > 0xffff) {
+            ticks = 0xffff;
+        }
+    }
+
+    cli();
+    led[nr].pattern = led_patterns[mode];
+    led[nr].step = 32;
+    led[nr].repeat = repeat;
+    led[nr].ticks = ticks;
+    sei();
+    return true;
+}
 
+bool ledtimer_set_pattern(uint8_t mode, uint32_t pattern) {
+    switch (mode) {
+        case LED_MODE_OFF:
+        case LED_MODE_BLINK1:
         case LED_MODE_BLINK2:
-            digitalWrite(led->pin, (now & 0x40)?LOW:HIGH);
-            break;
+        case LED_MODE_ON:
+            // These are relied on by the sketch and the host protocol
+            return false;
+    }
+    if (mode >= LED_MODES) {
+        return false;
     }
+    cli();
+    led_patterns[mode] = pattern;
+    sei();
+    return true;
 }
 
-ISR(TIMER1_COMPA_vect) {
-    // TODO: dont hardcode to two devices
-    led_update(&led[0]);
-    led_update(&led[1]);
+static void led_update(struct led_channel *led) {
+    if (!led->port) {
+        return;
+    }
+
+    if (led->pattern & step_mask) {
+        *led->port |= led->mask;
+    } else {
+        *led->port &= ~led->mask;
+    }
+
+    if (!--led->step) {
+        led->step = 32;
+        if (led->repeat && !--led->repeat) {
+            // The next state is always "off"
+            led->pattern = 0;
+        }
+    }
+
+    if (led->ticks && !--led->ticks) {
+        led->pattern = 0;
+    }
 }
 
+bool ledtimer_isr_time(unsigned long *us) {
+    if (!isr_ran) {
+        return false;
+    }
+    isr_ran = false;
+    *us = (unsigned long)isr_counts * LEDTIMER_COUNT_MICROS;
+    return true;
+}
+
+ISR(TIMER1_COMPA_vect) {
+    for (uint8_t i = 0; i < LEDTIMER_CHANNELS; i++) {
+        led_update(&led[i]);
+    }
+    step_mask <<= 1;
+    if (!step_mask) {
+        step_mask = 1;
+    }
+
+    // The timer went back to zero at the compare match, so its count is the
+    // time taken since then, including getting into the ISR
+    uint16_t counts = TCNT1;
+    isr_counts = counts > 0xff ? 0xff : counts;
+    isr_ran = true;
+}
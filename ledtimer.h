@@ -4,23 +4,55 @@
  *
  * This is a timer driven, automatic LED state handler.
  * It is intended to be generic enough to be reusable in other projects
+ *
+ * Each channel plays a 32 step pattern, one step per timer tick, with the
+ * lowest bit first.  All of the channels are on the same step, so a pattern
+ * starts from wherever the shared tick is, and each pass is the 32 steps from
+ * there.  The pattern can be limited to a number of repeats and/or a
+ * duration, after which the channel turns off.
  */
 #pragma once
 
 #include <stdint.h>
 
+#ifndef LEDTIMER_CHANNELS
+#define LEDTIMER_CHANNELS 2
+#endif
+
+#define LEDTIMER_TICK_MILLIS 100
+
+// The timer counts at 16MHz / 256
+#define LEDTIMER_COUNT_MICROS 16
+
+// The patterns are numbered by mode.  Modes 0 to 2 and 9 are fixed, the
+// others can be replaced at runtime with ledtimer_set_pattern()
 #define LED_MODE_OFF    0
 #define LED_MODE_BLINK1 1   // phase1
 #define LED_MODE_BLINK2 2   // phase2
 #define LED_MODE_ON     9
+#define LED_MODES       10
 
-struct led_status {
-    uint8_t pin;
-    uint8_t mode;
-    unsigned long next_state_millis;
+struct led_channel {
+    volatile uint8_t *port;     // The PORTx register for the pin
+    uint8_t mask;               // The bit for the pin within that register
+    uint8_t step;               // Steps left in this pass of the pattern
+    uint8_t repeat;             // Passes left, or zero to repeat forever
+    uint16_t ticks;             // Ticks left, or zero to never expire
+    uint32_t pattern;
 };
 
-extern struct led_status led[2];
-
 void ledtimer_init();
 
+// Assign a pin to a channel and make it an output
+void led_attach(uint8_t nr, uint8_t pin);
+
+// Start a channel playing the pattern for the given mode.  A duration of zero
+// plays it forever (or for the given number of repeats)
+bool led_set(uint8_t nr, uint8_t mode, uint16_t duration_millis, uint8_t repeat = 0);
+
+bool ledtimer_set_pattern(uint8_t mode, uint32_t pattern);
+
+// Get how long the timer ISR took the last time it ran, to the nearest timer
+// count.  This returns false if it has not run since the last call, and
+// keeps the timing work out of the ISR itself.
+bool ledtimer_isr_time(unsigned long *us);
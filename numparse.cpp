@@ -0,0 +1,51 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Parsing of the decimal arguments in host commands
+ */
+
+#include "numparse.h"
+
+bool parse_u16(uint16_t *val, const uint8_t *buf, uint8_t len) {
+    uint32_t n = 0;
+    if (!len) {
+        return false;
+    }
+    while (len--) {
+        uint8_t digit = *buf++ - '0';
+        if (digit > 9) {
+            return false;
+        }
+        n = n * 10 + digit;
+        if (n > 0xffff) {
+            return false;
+        }
+    }
+    *val = n;
+    return true;
+}
+
+uint8_t parse_args(uint16_t *args, uint8_t maxargs, const uint8_t *buf, uint8_t len) {
+    uint8_t nr = 0;
+    while (len) {
+        uint8_t n = 0;
+        while (n < len && buf[n] != ',') {
+            n++;
+        }
+        if (nr >= maxargs || !parse_u16(&args[nr], buf, n)) {
+            return 0xff;
+        }
+        nr++;
+        if (n == len) {
+            break;
+        }
+        // Skip the comma, which must be followed by another number
+        buf += n + 1;
+        len -= n + 1;
+        if (!len) {
+            return 0xff;
+        }
+    }
+    return nr;
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Parsing of the decimal arguments in host commands.  This is shared with
+ * the reader simulator in gateway/, so that it accepts exactly what the
+ * sketch does.
+ */
+#pragma once
+
+#include <stdint.h>
+
+// Parse a decimal number, returning false if it is not one or is too big
+bool parse_u16(uint16_t *val, const uint8_t *buf, uint8_t len);
+
+// Parse a comma separated list of decimal numbers, returning how many were
+// found, or 0xff if there were more than maxargs or any were malformed
+uint8_t parse_args(uint16_t *args, uint8_t maxargs, const uint8_t *buf, uint8_t len);
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Non-blocking buffered output to the serial port.
+ */
+
+#include <Arduino.h>
+
+#include "outbuf.h"
+#include "packets.h"
+#include "stats.h"
+
+#define MASK (OUTBUF_SIZE - 1)
+
+OutBuf outbuf;
+
+size_t OutBuf::write(uint8_t ch) {
+    if (ch == '\x02') {
+        in_packet = true;
+        discarding = false;
+        packet_head = head;
+    }
+
+    if (discarding) {
+        if (ch == '\x04') {
+            discarding = false;
+            in_packet = false;
+        }
+        return 1;
+    }
+
+    if (used() >= OUTBUF_SIZE - 1) {
+        if (in_packet) {
+            // Forget the partial packet, and skip the rest of it
+            head = packet_head;
+            discarding = (ch != '\x04');
+            in_packet = false;
+            dropped++;
+        } else if (!dropping_text) {
+            dropping_text = true;
+            dropped++;
+        }
+        return 1;
+    }
+
+    dropping_text = false;
+    buf[head++ & MASK] = ch;
+    if (ch == '\x04') {
+        in_packet = false;
+    }
+    return 1;
+}
+
+size_t OutBuf::write(const uint8_t *src, size_t size) {
+    size_t n = size;
+    while (n--) {
+        write(*src++);
+    }
+    return size;
+}
+
+int OutBuf::availableForWrite() {
+    return OUTBUF_SIZE - 1 - used();
+}
+
+void OutBuf::report_dropped() {
+    // Only once there is room for the report and it cannot split a packet
+    if (!dropped || in_packet || availableForWrite() < 20) {
+        return;
+    }
+
+    uint16_t count = dropped;
+    dropped = 0;
+    packet_start((*this));
+    print(F("overflow="));
+    print(count);
+    packet_end((*this));
+}
+
+void OutBuf::drain() {
+    report_dropped();
+
+    // Never send part of a packet that is still being written, as it might
+    // yet be dropped
+    uint8_t end = in_packet ? packet_head : head;
+    int room = Serial.availableForWrite();
+    if (!room || tail == end) {
+        return;
+    }
+
+    unsigned long start = micros();
+
+    while (room > 0 && tail != end) {
+        uint8_t pos = tail & MASK;
+        uint8_t n = end - tail;
+        if (n > OUTBUF_SIZE - pos) {
+            n = OUTBUF_SIZE - pos;
+        }
+        if (n > room) {
+            n = room;
+        }
+        Serial.write(&buf[pos], n);
+        tail += n;
+        room -= n;
+    }
+    stats_record(STATS_OUTPUT, 0, micros() - start);
+}
+
+void OutBuf::flush() {
+    report_dropped();
+    while (tail != head) {
+        Serial.write(buf[tail++ & MASK]);
+    }
+}
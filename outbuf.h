@@ -0,0 +1,56 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Non-blocking buffered output to the serial port.
+ *
+ * Messages are built into a ring buffer and only handed to the serial port
+ * as fast as it can take them without blocking, in small chunks while the
+ * PN532 is busy.  Slow output can therefore never stall card processing.
+ *
+ * If the buffer fills up, the message being written is dropped as a whole
+ * (so that no half packets are sent) and the loss is later reported with an
+ * "overflow=" message.
+ */
+#pragma once
+
+#include <Print.h>
+#include <stdint.h>
+
+// Must be a power of two, no larger than 256
+#ifndef OUTBUF_SIZE
+#define OUTBUF_SIZE 256
+#endif
+
+class OutBuf : public Print {
+    public:
+        size_t write(uint8_t ch) override;
+        size_t write(const uint8_t *buf, size_t size) override;
+        using Print::write;
+
+        int availableForWrite() override;
+
+        // Send what the serial port will take without blocking
+        void drain();
+
+        // Send everything, blocking as needed (only for use at boot)
+        void flush();
+
+        uint8_t used() { return (uint8_t)(head - tail); }
+
+    private:
+        uint8_t buf[OUTBUF_SIZE];
+        uint8_t head = 0;
+        uint8_t tail = 0;
+
+        bool in_packet = false;
+        bool discarding = false;    // Dropping the rest of a packet
+        uint8_t packet_head;        // Where the current packet started
+
+        uint16_t dropped = 0;       // Lost packets (or runs of other text)
+        bool dropping_text = false;
+
+        void report_dropped();
+};
+
+extern OutBuf outbuf;
@@ -6,70 +6,336 @@
  */
 
 #include <Arduino.h>
+#include "allowlist.h"
 #include "arduino_cardreader.h"
+#include "byteops.h"
+#include "hexdump.h"
+#include "idcache.h"
 #include "ledtimer.h"
+#include "numparse.h"
+#include "outbuf.h"
+#include "packets.h"
+#include "presence.h"
+#include "stats.h"
 
-static void handle_serial_cmd(uint8_t *cmd, uint8_t len) {
-    // Only trivial one char commands are implemented
+static uint8_t crc8(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+    return crc;
+}
+
+static void packet_escaped(Print& p, uint8_t ch) {
+    if (ch == '\x02' || ch == '\x04' || ch == PACKET_ESC) {
+        p.write(PACKET_ESC);
+        ch ^= 0x20;
+    }
+    p.write(ch);
+}
+
+// The sequence number of the next card event
+static uint16_t event_seq;
+
+uint8_t packet_readers = 1;
+uint8_t packet_reader;
+
+void packet_event(Print& p, uint8_t type, uint8_t tag, const uint8_t *buf, uint8_t len, unsigned long when) {
+    uint8_t meta[7];
+    uint8_t metalen = 0;
+    uint8_t crc = 0;
+
+    if (output_flags & OUTPUT_SEQ) {
+        meta[metalen++] = event_seq & 0xff;
+        meta[metalen++] = event_seq >> 8;
+        for (uint8_t i = 0; i < 4; i++) {
+            meta[metalen++] = when & 0xff;
+            when >>= 8;
+        }
+        event_seq++;
+    }
+    if (packet_readers > 1) {
+        meta[metalen++] = packet_reader;
+    }
+
+    p.write('\x02');
+
+    packet_escaped(p, type);
+    crc = crc8(crc, type);
+    packet_escaped(p, len + metalen + 1);
+    crc = crc8(crc, len + metalen + 1);
+    packet_escaped(p, tag);
+    crc = crc8(crc, tag);
+    while (len--) {
+        packet_escaped(p, *buf);
+        crc = crc8(crc, *buf);
+        buf++;
+    }
+    for (uint8_t i = 0; i < metalen; i++) {
+        packet_escaped(p, meta[i]);
+        crc = crc8(crc, meta[i]);
+    }
+    packet_escaped(p, crc);
+
+    p.write('\x04');
+}
+
+void packet_event_end(Print& p, unsigned long when) {
+    if (packet_readers > 1) {
+        p.print(F(",reader="));
+        p.print(packet_reader);
+    }
+    if (output_flags & OUTPUT_SEQ) {
+        p.print(F(",seq="));
+        p.print(event_seq++);
+        p.print(F(",t="));
+        p.print(when);
+    }
+    packet_end(p);
+}
+
+void packet_print_clock(Print& p) {
+    packet_start(p);
+    p.print(F("clock="));
+    p.print(millis());
+    p.print(',');
+    p.print(event_seq);
+    packet_end(p);
+}
+
+static void print_holdoff(void) {
+    packet_start(outbuf);
+    outbuf.print(F("holdoff="));
+    outbuf.print(presence_holdoff);
+    packet_end(outbuf);
+}
+
+// L<led>,<mode>[,<millis>[,<repeats>]]
+static bool cmd_led(uint8_t *buf, uint8_t len) {
+    uint16_t args[4];
+    uint8_t nr = parse_args(args, 4, buf, len);
+    if (nr < 2 || nr == 0xff) {
+        return false;
+    }
+    if (nr < 3) {
+        args[2] = LED_COMMAND_MILLIS;
+    }
+    if (nr < 4) {
+        args[3] = 0;
+    }
+    if (args[0] > 0xff || args[1] > 0xff || args[3] > 0xff) {
+        return false;
+    }
+    return led_set(args[0], args[1], args[2], args[3]);
+}
+
+// P<mode>,<8 hex digits>
+static bool cmd_pattern(uint8_t *buf, uint8_t len) {
+    uint8_t n = 0;
+    while (n < len && buf[n] != ',') {
+        n++;
+    }
+
+    uint16_t mode;
+    uint8_t pattern[4];
+    if (!parse_u16(&mode, buf, n) || n == len || mode > 0xff) {
+        return false;
+    }
+    if (hexparse(pattern, sizeof(pattern), &buf[n + 1], len - n - 1) != sizeof(pattern)) {
+        return false;
+    }
+    return ledtimer_set_pattern(mode, buf_be2hl(pattern));
+}
+
+// Carry out one command, returning false if it was not understood
+static bool handle_serial_cmd(uint8_t *cmd, uint8_t len) {
+    uint16_t val;
+
+    if (len > 1) {
+        // Only the commands here take arguments
+        switch (cmd[0]) {
+            case '+':
+                if (!allowlist_add(&cmd[1], len - 1)) {
+                    return false;
+                }
+                allowlist_print_status(outbuf);
+                return true;
+            case 'h':
+                if (!parse_u16(&presence_holdoff, &cmd[1], len - 1)) {
+                    return false;
+                }
+                print_holdoff();
+                return true;
+            case 'L':
+                return cmd_led(&cmd[1], len - 1);
+            case 'P':
+                return cmd_pattern(&cmd[1], len - 1);
+            case 'O':
+                if (!parse_u16(&val, &cmd[1], len - 1) || val > 0xff) {
+                    return false;
+                }
+                output_flags = val;
+                return true;
+        }
+        return false;
+    }
     if (len != 1) {
-        return;
+        return false;
     }
 
     switch (cmd[0]) {
         case 'H':
-            Serial.println("Hello");
-            return;
+            outbuf.println(F("Hello"));
+            return true;
         case '0':
-            led[0].mode = LED_MODE_OFF;
-            led[1].mode = LED_MODE_OFF;
-            return;
+            led_set(0, LED_MODE_OFF, 0);
+            led_set(1, LED_MODE_OFF, 0);
+            return true;
         case '1':
-            led[0].mode = LED_MODE_ON;
-            led[0].next_state_millis = millis() + 20000;
-            return;
+            led_set(0, LED_MODE_ON, LED_COMMAND_MILLIS);
+            return true;
         case '2':
-            led[1].mode = LED_MODE_ON;
-            led[1].next_state_millis = millis() + 20000;
-            return;
+            led_set(1, LED_MODE_ON, LED_COMMAND_MILLIS);
+            return true;
         case '3':
-            led[0].mode = LED_MODE_BLINK1;
-            led[0].next_state_millis = millis() + 20000;
-            return;
+            led_set(0, LED_MODE_BLINK1, LED_COMMAND_MILLIS);
+            return true;
         case '4':
-            led[1].mode = LED_MODE_BLINK1;
-            led[1].next_state_millis = millis() + 20000;
-            return;
+            led_set(1, LED_MODE_BLINK1, LED_COMMAND_MILLIS);
+            return true;
         case '5':
-            led[0].mode = LED_MODE_BLINK2;
-            led[0].next_state_millis = millis() + 20000;
-            return;
+            led_set(0, LED_MODE_BLINK2, LED_COMMAND_MILLIS);
+            return true;
         case '6':
-            led[1].mode = LED_MODE_BLINK2;
-            led[1].next_state_millis = millis() + 20000;
-            return;
+            led_set(1, LED_MODE_BLINK2, LED_COMMAND_MILLIS);
+            return true;
         case '7':
-            led[0].mode = LED_MODE_BLINK1;
-            led[0].next_state_millis = millis() + 20000;
-            led[1].mode = LED_MODE_BLINK2;
-            led[1].next_state_millis = millis() + 20000;
-            return;
+            led_set(0, LED_MODE_BLINK1, LED_COMMAND_MILLIS);
+            led_set(1, LED_MODE_BLINK2, LED_COMMAND_MILLIS);
+            return true;
         case 'r':
             output_flags |= OUTPUT_RAWALL;
-            return;
+            return true;
         case 'R':
             output_flags &= ~OUTPUT_RAWALL;
-            return;
+            return true;
         case 't':
             output_flags |= OUTPUT_RAWTAG;
-            return;
+            return true;
         case 'T':
             output_flags &= ~OUTPUT_RAWTAG;
-            return;
+            return true;
+        case 'b':
+            output_flags |= OUTPUT_BINARY;
+            return true;
+        case 'B':
+            output_flags &= ~OUTPUT_BINARY;
+            return true;
+        case 'd':
+            output_flags |= OUTPUT_APDU;
+            return true;
+        case 'D':
+            output_flags &= ~OUTPUT_APDU;
+            return true;
+        case 'c':
+            output_flags |= OUTPUT_TRACE;
+            return true;
+        case 'C':
+            output_flags &= ~OUTPUT_TRACE;
+            return true;
+        case 'a':
+            allowlist_enable(true);
+            allowlist_print_status(outbuf);
+            return true;
+        case 'A':
+            allowlist_enable(false);
+            allowlist_print_status(outbuf);
+            return true;
+        case 'h':
+            print_holdoff();
+            return true;
+        case 'k':
+            idcache_print_stats(outbuf);
+            return true;
+        case 's':
+            stats_start_report();
+            return true;
+        case 'q':
+            output_flags |= OUTPUT_SEQ;
+            return true;
+        case 'Q':
+            output_flags &= ~OUTPUT_SEQ;
+            return true;
+        case 'm':
+            packet_print_clock(outbuf);
+            return true;
+        case 'Z':
+            allowlist_clear();
+            allowlist_print_status(outbuf);
+            return true;
+    }
+    return false;
+}
+
+// A frame holds one or more commands separated by ';'.  If the first one is
+// "#<id>", then the frame is answered with "ack=<id>" once all of the
+// commands have been carried out, or with "nak=<id>,<index>" giving the
+// index of the first command that failed (the rest are skipped).
+// Otherwise, a failure is answered with a single NAK char.
+static void handle_serial_frame(uint8_t *frame, uint8_t len) {
+    uint16_t id = 0;
+    bool have_id = false;
+    uint8_t index = 0;
+    bool ok = true;
+
+    while (len) {
+        uint8_t n = 0;
+        while (n < len && frame[n] != PACKET_CMD_SEP) {
+            n++;
+        }
+
+        if (!have_id && index == 0 && n > 1 && frame[0] == '#') {
+            if (!parse_u16(&id, &frame[1], n - 1)) {
+                outbuf.print('\x15');
+                return;
+            }
+            have_id = true;
+        } else if (!handle_serial_cmd(frame, n)) {
+            ok = false;
+            break;
+        } else {
+            index++;
+        }
+
+        if (n == len) {
+            break;
+        }
+        frame += n + 1;
+        len -= n + 1;
+    }
+
+    if (!have_id) {
+        if (!ok) {
+            outbuf.print('\x15');
+        }
+        return;
+    }
+
+    packet_start(outbuf);
+    if (ok) {
+        outbuf.print(F("ack="));
+        outbuf.print(id);
+    } else {
+        outbuf.print(F("nak="));
+        outbuf.print(id);
+        outbuf.print(',');
+        outbuf.print(index);
     }
+    packet_end(outbuf);
 }
 
 // Buffer to accumulate incoming message packets
-uint8_t cmd[8];
+uint8_t cmd[PACKET_CMD_MAX];
 uint8_t cmdpos = 0xff;
 
 void handle_serial(uint8_t ch) {
@@ -80,7 +346,9 @@ void handle_serial(uint8_t ch) {
     }
     if (ch == '\x04') {
         // End of frame
-        handle_serial_cmd(cmd, cmdpos);
+        if (cmdpos != 0xff) {
+            handle_serial_frame(cmd, cmdpos);
+        }
         cmdpos = 0xff;
         return;
     }
@@ -90,7 +358,7 @@ void handle_serial(uint8_t ch) {
     }
     if (cmdpos >= sizeof(cmd)) {
         // Overflow, alert and discard until end of packet
-        Serial.print('\x15');
+        outbuf.print('\x15');
         cmdpos = 0xff;
         return;
     }
@@ -6,7 +6,60 @@
  */
 #pragma once
 
+#include <Print.h>
+#include <stdint.h>
+
 #define packet_start(p)  p.print('\x02')
 #define packet_end(p)    p.println('\x04')
 
+// When OUTPUT_BINARY is set, the card events are sent as compact binary
+// records instead of text messages.  Each record is framed just like a text
+// message, and its body is:
+//
+//      u8  type        one of the EVENT_ values, always >= 0x80
+//      u8  len         the length of the value
+//      u8  value[len]  a tag byte, then any data
+//      u8  crc         CRC-8 (poly 0x07) over type, len and value
+//
+// Any STX, EOT or PACKET_ESC byte in the body is sent as PACKET_ESC followed
+// by the byte xor 0x20, so the framing is never broken.  No line ending is
+// sent after a binary record.
+//
+// When OUTPUT_SEQ is set, every card event also carries a sequence number
+// (which the host can use to spot lost events) and the millis() time that
+// the card was detected.  Text messages get ",seq=N,t=MILLIS" added to the
+// end, and binary records get a u16 seq and u32 time (both little endian)
+// added to the end of the value.
+//
+// When more than one reader is in use, every card event also carries the
+// index of the reader that saw it.  Text messages get ",reader=N" added
+// (before any sequence number) and binary records get a u8 reader index
+// added to the end of the value, after any sequence data.
+#define EVENT_UID       0x81    // tag=uid_type, data=uid
+#define EVENT_SERIAL    0x82    // tag=info_type, data=serial digits
+#define EVENT_CARDID    0x83    // tag=uid_type or info_type, data as above
+#define EVENT_DEPART    0x84    // tag=0, no data
+#define EVENT_RAWTAG    0x85    // tag=InAutoPoll type, data=target data
+#define EVENT_DECISION  0x86    // tag=1 for allow or 0 for deny, no data
+#define EVENT_GONE      0x87    // tag=uid_type, data=uid
+#define EVENT_READER    0x88    // tag=1 for up or 0 for down, no data
+
+#define PACKET_ESC      0x10
+
+// The largest command frame we accept, and the command separator within it
+#define PACKET_CMD_MAX  64
+#define PACKET_CMD_SEP  ';'
+
+// How many readers are in use, and the one that events are coming from
+extern uint8_t packet_readers;
+extern uint8_t packet_reader;
+
+void packet_event(Print& p, uint8_t type, uint8_t tag, const uint8_t *buf, uint8_t len, unsigned long when);
+
+// Finish a text card event message
+void packet_event_end(Print& p, unsigned long when);
+
+// Send the clock= message
+void packet_print_clock(Print& p);
+
 void handle_serial(uint8_t ch);
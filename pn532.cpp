@@ -0,0 +1,309 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A non-blocking driver for a PN532
+ *
+ * Each frame is:
+ *
+ *      00 00 ff LEN LCS TFI PD0..PDn DCS 00
+ *
+ * with TFI being d4 from the host or d5 from the PN532, and the first data
+ * byte being the command code (or the command code + 1 in the response).
+ */
+
+#include <Adafruit_PN532.h>
+#include <Arduino.h>
+
+#include "arduino_cardreader.h"
+#include "pn532.h"
+#include "stats.h"
+#include "trace.h"
+
+// The frames are moved in chunks of this size, so that each chunk is a
+// single burst on the transport
+#define PN532_CHUNK 16
+
+static const uint8_t ack_frame[] PROGMEM = {0x00, 0x00, 0xff, 0x00, 0xff, 0x00};
+
+void PN532::abort(void) {
+    // Sending an ACK to the PN532 makes it abandon the current command
+    uint8_t ack[sizeof(ack_frame)];
+    memcpy_P(ack, ack_frame, sizeof(ack));
+    bus.start(PN532_SPI_DATAWRITE);
+    bus.transfer(ack, sizeof(ack));
+    bus.end();
+    state = PN532_FAILED;
+    errors++;
+}
+
+// Add a byte to the chunk, sending the chunk once it is full
+static void chunk_add(PN532Transport& bus, uint8_t *chunk, uint8_t *pos, uint8_t ch) {
+    chunk[(*pos)++] = ch;
+    if (*pos == PN532_CHUNK) {
+        bus.transfer(chunk, PN532_CHUNK);
+        *pos = 0;
+    }
+}
+
+bool PN532::send(uint8_t code, const uint8_t *hdr, uint8_t hdrlen, const uint8_t *data, uint8_t datalen) {
+    if (state == PN532_WAIT_ACK || state == PN532_WAIT_RES) {
+        return false;
+    }
+
+    uint8_t len = 2 + hdrlen + datalen;     // TFI, code and the rest
+    uint8_t sum = PN532_HOSTTOPN532 + code;
+
+    uint8_t chunk[PN532_CHUNK];
+    chunk[0] = PN532_PREAMBLE;
+    chunk[1] = PN532_STARTCODE1;
+    chunk[2] = PN532_STARTCODE2;
+    chunk[3] = len;
+    chunk[4] = ~len + 1;
+    chunk[5] = PN532_HOSTTOPN532;
+    chunk[6] = code;
+    uint8_t pos = 7;
+
+    bus.start(PN532_SPI_DATAWRITE);
+    while (hdrlen--) {
+        sum += *hdr;
+        chunk_add(bus, chunk, &pos, *hdr++);
+    }
+    while (datalen--) {
+        sum += *data;
+        chunk_add(bus, chunk, &pos, *data++);
+    }
+    chunk_add(bus, chunk, &pos, ~sum + 1);
+    chunk_add(bus, chunk, &pos, PN532_POSTAMBLE);
+    if (pos) {
+        bus.transfer(chunk, pos);
+    }
+    bus.end();
+
+    this->code = code;
+    started = micros();
+    state = PN532_WAIT_ACK;
+    return true;
+}
+
+uint8_t PN532::poll(void) {
+    if (state != PN532_WAIT_ACK && state != PN532_WAIT_RES) {
+        return state;
+    }
+
+    if (!bus.ready()) {
+        unsigned long timeout = state == PN532_WAIT_ACK ? PN532_ACK_TIMEOUT_MILLIS : PN532_TIMEOUT_MILLIS;
+        if ((micros() - started) > timeout * 1000UL) {
+            abort();
+        }
+        return state;
+    }
+
+    if (state == PN532_WAIT_RES) {
+        state = PN532_READY;
+        return state;
+    }
+
+    uint8_t ack[sizeof(ack_frame)];
+    bus.start(PN532_SPI_DATAREAD);
+    bus.transfer(ack, sizeof(ack));
+    bus.end();
+
+    if (memcmp_P(ack, ack_frame, sizeof(ack)) != 0) {
+        state = PN532_FAILED;
+        errors++;
+        return state;
+    }
+    state = PN532_WAIT_RES;
+    return state;
+}
+
+bool PN532::read(uint8_t *status, uint8_t *buf, uint8_t *buflen) {
+    if (state != PN532_READY) {
+        state = PN532_IDLE;
+        return false;
+    }
+    state = PN532_IDLE;
+
+    // The header, response code and status in one go
+    uint8_t hdr[8];
+    bus.start(PN532_SPI_DATAREAD);
+    bus.transfer(hdr, sizeof(hdr));
+
+    // We always expect at least the response code
+    if (hdr[0] != PN532_PREAMBLE || hdr[1] != PN532_STARTCODE1 ||
+        hdr[2] != PN532_STARTCODE2 || (uint8_t)(hdr[3] + hdr[4]) != 0 ||
+        hdr[3] < 2 || hdr[5] != PN532_PN532TOHOST) {
+        bus.end();
+        errors++;
+        return false;
+    }
+
+    if (hdr[3] == 2) {
+        // No status byte (as for SAMConfiguration), so that was the DCS and
+        // only the postamble is left
+        uint8_t post;
+        bus.transfer(&post, 1);
+        bus.end();
+        *status = 0;
+        *buflen = 0;
+        return frame_ok(hdr[5] + hdr[6] + hdr[7], hdr[6]);
+    }
+
+    uint8_t len = hdr[3] - 3;
+    uint8_t sum = hdr[5] + hdr[6] + hdr[7];
+    uint8_t res_code = hdr[6];
+    *status = hdr[7];
+
+    // The data goes straight into buf
+    uint8_t n = len < *buflen ? len : *buflen;
+    if (n) {
+        bus.transfer(buf, n);
+    }
+    for (uint8_t i = 0; i < n; i++) {
+        sum += buf[i];
+    }
+
+    // Then anything that did not fit, the DCS and the postamble, which has
+    // to be taken too so that a UART is left at the start of the next frame
+    uint16_t rest = len - n + 2;
+    while (rest) {
+        uint8_t tail[PN532_CHUNK];
+        uint8_t m = rest < sizeof(tail) ? rest : sizeof(tail);
+        bus.transfer(tail, m);
+        for (uint8_t i = 0; i < m; i++) {
+            if (rest - i > 1) {
+                sum += tail[i];
+            }
+        }
+        rest -= m;
+    }
+    bus.end();
+
+    *buflen = n;
+    return frame_ok(sum, res_code);
+}
+
+bool PN532::frame_ok(uint8_t sum, uint8_t res_code) {
+    if (sum != 0 || res_code != code + 1) {
+        errors++;
+        return false;
+    }
+    errors = 0;
+    return true;
+}
+
+/*
+ * The card operations
+ */
+
+// Normal mode, with the default timeout and the IRQ pin used, as the
+// library sets it up
+static const uint8_t samconfig_hdr[] PROGMEM = {0x01, 0x14, 0x01};
+
+bool pn532_begin_start(PN532& nfc) {
+    // Anything that has finished (or failed) can be dropped
+    uint8_t state = nfc.poll();
+    if (state == PN532_WAIT_ACK || state == PN532_WAIT_RES) {
+        return false;
+    }
+    nfc.wakeup();
+    return nfc.send(PN532_COMMAND_GETFIRMWAREVERSION, NULL, 0, NULL, 0);
+}
+
+bool pn532_begin_done(PN532& nfc, uint32_t *version) {
+    uint8_t state = nfc.poll();
+    if (state != PN532_READY && state != PN532_FAILED) {
+        return false;
+    }
+
+    uint8_t status = 0;
+    uint8_t ver[3];
+    uint8_t verlen = sizeof(ver);
+    bool ok = nfc.read(&status, ver, &verlen);
+
+    if (nfc.command() == PN532_COMMAND_GETFIRMWAREVERSION) {
+        if (!ok || verlen != sizeof(ver)) {
+            *version = 0;
+            return true;
+        }
+        // The status byte is the IC
+        *version = (uint32_t)status << 24 | (uint32_t)ver[0] << 16 | (uint32_t)ver[1] << 8 | ver[2];
+
+        // Then on to the SAMConfiguration, leaving the version where it is
+        // until that has finished too
+        uint8_t hdr[sizeof(samconfig_hdr)];
+        memcpy_P(hdr, samconfig_hdr, sizeof(hdr));
+        nfc.send(PN532_COMMAND_SAMCONFIGURATION, hdr, sizeof(hdr), NULL, 0);
+        return false;
+    }
+
+    if (!ok) {
+        *version = 0;
+    }
+    return true;
+}
+
+// The target types to poll for, see 7.3.13 of the PN532 User Manual
+static const uint8_t autopoll_hdr[] PROGMEM = {
+    0x01,   // PollNr: poll once
+    0x01,   // Period: 150ms
+    TYPE_MIFARE,
+    TYPE_FELICA_212,
+    TYPE_FELICA_424,
+    TYPE_ISO14443A,
+};
+
+bool pn532_autopoll_start(PN532& nfc) {
+    uint8_t hdr[sizeof(autopoll_hdr)];
+    memcpy_P(hdr, autopoll_hdr, sizeof(hdr));
+    return nfc.send(PN532_COMMAND_INAUTOPOLL, hdr, sizeof(hdr), NULL, 0);
+}
+
+bool pn532_autopoll_done(PN532& nfc, uint8_t *buf, uint8_t buflen, uint8_t *found) {
+    uint8_t state = nfc.poll();
+    if (state != PN532_READY && state != PN532_FAILED) {
+        return false;
+    }
+
+    if (!nfc.read(found, buf, &buflen)) {
+        *found = 0;
+        buflen = 0;
+    }
+    stats_record(STATS_POLL, 0, micros() - nfc.started);
+    trace_autopoll(nfc.started, *found, buf, buflen);
+    return true;
+}
+
+uint8_t pn532_autopoll_len(uint8_t *buf, uint8_t found, uint8_t buflen) {
+    // Each target is a type byte, a length byte and then its data
+    uint8_t pos = 0;
+    while (found-- && pos + 2 <= buflen) {
+        pos += 2 + buf[pos + 1];
+    }
+    if (pos > buflen) {
+        pos = buflen;
+    }
+    return pos;
+}
+
+bool pn532_exchange(PN532& nfc, uint8_t tg, uint8_t *cmd, uint8_t cmdlen, uint8_t *res, uint8_t *reslen) {
+    if (!nfc.send(PN532_COMMAND_INDATAEXCHANGE, &tg, 1, cmd, cmdlen)) {
+        return false;
+    }
+
+    while (nfc.poll() < PN532_READY) {
+        idle_tasks();
+    }
+
+    uint8_t status = 0;
+    bool ok = nfc.read(&status, res, reslen);
+
+    // The low bits of the status are the error code
+    if (ok && (status & 0x3f) != 0) {
+        ok = false;
+    }
+    stats_record(STATS_EXCHANGE, cmd[0], micros() - nfc.started);
+    trace_exchange(nfc.started, tg, ok, cmd, cmdlen, res, ok ? *reslen : 0);
+    return ok;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A non-blocking driver for a PN532, and the single path that all card
+ * operations go through, so that they can be observed (see trace.h)
+ *
+ * A command is written to the PN532 as a frame, and then each call to
+ * poll() checks the ready status, collecting the acknowledgement and then
+ * noting when the response is ready to be read.  This leaves the sketch
+ * free to do other work while the PN532 is busy with the RF side, instead
+ * of blocking for the whole operation as the library calls do.
+ *
+ * The frames go over a transport (see pn532_transport.h), which can be the
+ * SPI bus, a UART or a recording held in memory.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "pn532_transport.h"
+
+#define PN532_IDLE      0
+#define PN532_WAIT_ACK  1   // The command has been sent
+#define PN532_WAIT_RES  2   // The command has been acknowledged
+#define PN532_READY     3   // The response is waiting to be read
+#define PN532_FAILED    4
+
+// Give up on a command that takes longer than this
+#ifndef PN532_TIMEOUT_MILLIS
+#define PN532_TIMEOUT_MILLIS 1000
+#endif
+
+// The ACK comes back within a millisecond or so, so a PN532 that has gone
+// away (or been reset) is noticed much sooner by its missing ACK
+#ifndef PN532_ACK_TIMEOUT_MILLIS
+#define PN532_ACK_TIMEOUT_MILLIS 30
+#endif
+
+class PN532 {
+    public:
+        PN532(PN532Transport& bus) : errors(0), bus(bus), state(PN532_IDLE) {};
+
+        // Start a command, with a body made up of the command code, then hdr
+        // and then data.  Returns false if a command is already running.
+        bool send(uint8_t code, const uint8_t *hdr, uint8_t hdrlen, const uint8_t *data, uint8_t datalen);
+
+        // Check on the command, returning the new state
+        uint8_t poll(void);
+
+        bool busy(void) { return state != PN532_IDLE; };
+
+        // The command code of the current (or last) command
+        uint8_t command(void) { return code; };
+
+        void wakeup(void) { bus.wakeup(); };
+
+        // Read the response, once poll() returns PN532_READY.  The first
+        // byte after the response code is returned in status and the rest
+        // in buf.  On entry, buflen is the size of buf and it is updated to
+        // the size of the response.
+        bool read(uint8_t *status, uint8_t *buf, uint8_t *buflen);
+
+        // When the current command was sent, in micros()
+        unsigned long started;
+
+        // Faults of the PN532 itself (a missing ACK or response, or a bad
+        // frame) since its last good response.  A card that does not answer
+        // is not a fault, as the PN532 still reports that properly.
+        uint8_t errors;
+
+    private:
+        PN532Transport& bus;
+        uint8_t state;
+        uint8_t code;
+
+        void abort(void);
+        bool frame_ok(uint8_t sum, uint8_t res_code);
+};
+
+// Start waking up and configuring the PN532, returning false if it is busy
+bool pn532_begin_start(PN532& nfc);
+
+// Check on the configuration, returning false while it is still running.
+// Once it has finished, version is set to the firmware version (as the
+// GetFirmwareVersion IC, Ver, Rev and Support bytes), or 0 if the PN532 did
+// not answer.
+bool pn532_begin_done(PN532& nfc, uint32_t *version);
+
+// Start an InAutoPoll, returning false if the PN532 is busy
+bool pn532_autopoll_start(PN532& nfc);
+
+// Check on the InAutoPoll, returning false while it is still running.  Once
+// it has finished, found is set to the number of targets in buf.
+bool pn532_autopoll_done(PN532& nfc, uint8_t *buf, uint8_t buflen, uint8_t *found);
+
+// How many bytes of an InAutoPoll result hold the found targets
+uint8_t pn532_autopoll_len(uint8_t *buf, uint8_t found, uint8_t buflen);
+
+// Send a command to the target and collect its response, running the idle
+// tasks while waiting.  On entry, reslen is the size of res and on success
+// it is updated to the response size.  The cmd buffer is still needed after
+// the exchange, so res must not be the same buffer.
+bool pn532_exchange(PN532& nfc, uint8_t tg, uint8_t *cmd, uint8_t cmdlen, uint8_t *res, uint8_t *reslen);
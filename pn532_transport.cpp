@@ -0,0 +1,134 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * The ways of getting frames to and from a PN532
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "pn532_transport.h"
+
+/*
+ * SPI
+ *
+ * Each transfer starts with a byte saying what it is (a status read, data
+ * write or data read) and the bytes go least significant bit first.
+ */
+
+void PN532SPI::select(void) {
+    SPI.beginTransaction(SPISettings(PN532_SPI_CLOCK, LSBFIRST, SPI_MODE0));
+    digitalWrite(ss, LOW);
+}
+
+void PN532SPI::wakeup(void) {
+    // The bus is shared, so it only needs setting up for the first one
+    static bool spi_begun;
+    if (!spi_begun) {
+        SPI.begin();
+        spi_begun = true;
+    }
+
+    // Holding SS low for a moment wakes it up
+    pinMode(ss, OUTPUT);
+    select();
+    delay(2);
+    end();
+}
+
+bool PN532SPI::ready(void) {
+    uint8_t buf[2] = {PN532_SPI_STATREAD, 0};
+    select();
+    SPI.transfer(buf, sizeof(buf));
+    end();
+    return buf[1] & PN532_SPI_READY;
+}
+
+void PN532SPI::start(uint8_t op) {
+    select();
+    SPI.transfer(op);
+}
+
+void PN532SPI::transfer(uint8_t *buf, uint8_t len) {
+    SPI.transfer(buf, len);
+}
+
+void PN532SPI::end(void) {
+    digitalWrite(ss, HIGH);
+    SPI.endTransaction();
+}
+
+/*
+ * HSU
+ *
+ * The frames are just sent and received as they are, so there is nothing
+ * to say which one is wanted - the ACK and then the response arrive in
+ * order, and anything left over from an earlier command is thrown away
+ * before a new one is sent.
+ */
+
+void PN532HSU::wakeup(void) {
+    // Some 0x55 bytes wake it up, and then it needs a little while before
+    // the first command
+    static const uint8_t wake[] PROGMEM = {
+        0x55, 0x55, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+    port.begin(PN532_HSU_BAUD);
+    for (uint8_t i = 0; i < sizeof(wake); i++) {
+        port.write(pgm_read_byte(&wake[i]));
+    }
+    port.flush();
+    delay(2);
+}
+
+bool PN532HSU::ready(void) {
+    return port.available() > 0;
+}
+
+void PN532HSU::start(uint8_t op) {
+    reading = op == PN532_SPI_DATAREAD;
+    if (!reading) {
+        while (port.available()) {
+            port.read();
+        }
+    }
+}
+
+void PN532HSU::transfer(uint8_t *buf, uint8_t len) {
+    if (!reading) {
+        port.write(buf, len);
+        return;
+    }
+
+    // The rest of the frame is on its way, at about 87us a byte
+    unsigned long started = millis();
+    while (len) {
+        int ch = port.read();
+        if (ch >= 0) {
+            *buf++ = ch;
+            len--;
+            continue;
+        }
+        if ((millis() - started) > PN532_HSU_TIMEOUT_MILLIS) {
+            // The checksums will catch this
+            memset(buf, 0, len);
+            return;
+        }
+    }
+}
+
+/*
+ * Recorded
+ */
+
+void PN532Recorded::transfer(uint8_t *buf, uint8_t n) {
+    if (!reading) {
+        written += n;
+        return;
+    }
+    while (n--) {
+        *buf++ = pos < len ? data[pos++] : 0;
+    }
+}
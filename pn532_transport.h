@@ -0,0 +1,111 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * The ways of getting frames to and from a PN532 (see pn532.h)
+ *
+ * The driver builds and checks the frames, and a transport only has to
+ * move the bytes.  Each frame is moved in bursts of several bytes at once,
+ * between start() and end(), rather than a call for every byte.
+ *
+ * The transports are virtual, and avr-gcc copies each vtable that is used
+ * into .data, so as well as a 2 byte vtable pointer in each transport, every
+ * transport class that the sketch uses costs about 14 bytes of RAM (two
+ * header words and five function pointers).  Classes that are not used, such
+ * as PN532HSU in the default build, are dropped by the linker.
+ */
+#pragma once
+
+#include <Adafruit_PN532.h>
+#include <Arduino.h>
+#include <stdint.h>
+
+#ifndef PN532_SPI_CLOCK
+#define PN532_SPI_CLOCK 1000000
+#endif
+
+#define PN532_HSU_BAUD  115200
+
+// How long to wait for the rest of a frame that has started arriving
+#ifndef PN532_HSU_TIMEOUT_MILLIS
+#define PN532_HSU_TIMEOUT_MILLIS 10
+#endif
+
+class PN532Transport {
+    public:
+        // Bring the PN532 out of its power down state, ready for a command
+        virtual void wakeup(void) = 0;
+
+        // Whether the PN532 has a frame (the ACK or a response) to be read
+        virtual bool ready(void) = 0;
+
+        // Start writing a frame (PN532_SPI_DATAWRITE) or reading the next
+        // one (PN532_SPI_DATAREAD)
+        virtual void start(uint8_t op) = 0;
+
+        // Send the bytes in buf, or when reading, replace them with the next
+        // bytes of the frame
+        virtual void transfer(uint8_t *buf, uint8_t len) = 0;
+
+        virtual void end(void) = 0;
+};
+
+// The PN532 on the hardware SPI bus, with its own SS pin
+class PN532SPI : public PN532Transport {
+    public:
+        PN532SPI(uint8_t ss) : ss(ss) {};
+
+        void wakeup(void) override;
+        bool ready(void) override;
+        void start(uint8_t op) override;
+        void transfer(uint8_t *buf, uint8_t len) override;
+        void end(void) override;
+
+    private:
+        uint8_t ss;
+
+        void select(void);
+};
+
+// The PN532 on a UART, in its HSU mode.  This needs a spare hardware UART,
+// as the one on an Uno or Pro Mini is used for the host.
+class PN532HSU : public PN532Transport {
+    public:
+        PN532HSU(HardwareSerial& port) : port(port) {};
+
+        void wakeup(void) override;
+        bool ready(void) override;
+        void start(uint8_t op) override;
+        void transfer(uint8_t *buf, uint8_t len) override;
+        void end(void) override {};
+
+    private:
+        HardwareSerial& port;
+        bool reading;
+};
+
+// Plays back, from memory, the bytes that a PN532 sent in an earlier
+// session (the ACK and response frame for each command, one after another).
+// It is always ready and everything written to it is just counted, so the
+// cost of the driver itself can be measured with no bus or card involved.
+class PN532Recorded : public PN532Transport {
+    public:
+        PN532Recorded(const uint8_t *data, uint16_t len) : data(data), len(len) {};
+
+        // Start the playback again from the beginning
+        void rewind(void) { pos = 0; };
+
+        uint32_t written = 0;
+
+        void wakeup(void) override {};
+        bool ready(void) override { return true; };
+        void start(uint8_t op) override { reading = op == PN532_SPI_DATAREAD; };
+        void transfer(uint8_t *buf, uint8_t len) override;
+        void end(void) override {};
+
+    private:
+        const uint8_t *data;
+        uint16_t len;
+        uint16_t pos = 0;
+        bool reading = false;
+};
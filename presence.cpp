@@ -0,0 +1,124 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tracks which cards are currently in front of each reader
+ */
+
+#include <Arduino.h>
+
+#include "arduino_cardreader.h"
+#include "card.h"
+#include "outbuf.h"
+#include "packets.h"
+#include "presence.h"
+
+uint16_t presence_holdoff = PRESENCE_HOLDOFF_MILLIS;
+
+static struct presence_entry table[PRESENCE_MAX];
+static uint8_t any_present;    // A bit for each reader
+
+static struct presence_entry *lookup(uint8_t reader, Card& card) {
+    for (uint8_t i = 0; i < PRESENCE_MAX; i++) {
+        struct presence_entry *e = &table[i];
+        if (e->state == PRESENCE_DEPARTED) {
+            continue;
+        }
+        if (e->reader != reader) {
+            continue;
+        }
+        if (e->uid_type != card.uid_type || e->uid_len != card.uid_len) {
+            continue;
+        }
+        if (memcmp(e->uid, card.uid, card.uid_len) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void depart(Print& p, struct presence_entry *e) {
+    Card card;
+    card.set_uid_type(e->uid_type);
+    card.set_uid(e->uid, e->uid_len);
+    card.detected = millis();
+
+    // The slot might be taken from a card on another reader
+    uint8_t reader = packet_reader;
+    packet_reader = e->reader;
+    card.print_departed_msg(p);
+    packet_reader = reader;
+
+    e->state = PRESENCE_DEPARTED;
+}
+
+uint8_t presence_seen(uint8_t reader, Card& card) {
+    unsigned long now = millis();
+    struct presence_entry *e = lookup(reader, card);
+
+    if (!e) {
+        // Use a free slot, or make one by retiring the stalest card
+        e = &table[0];
+        for (uint8_t i = 0; i < PRESENCE_MAX; i++) {
+            if (table[i].state == PRESENCE_DEPARTED) {
+                e = &table[i];
+                break;
+            }
+            if ((now - table[i].last_seen) > (now - e->last_seen)) {
+                e = &table[i];
+            }
+        }
+        if (e->state != PRESENCE_DEPARTED) {
+            depart(outbuf, e);
+        }
+
+        e->state = PRESENCE_ARRIVED;
+        e->reader = reader;
+        e->uid_type = card.uid_type;
+        e->uid_len = card.uid_len;
+        memcpy(e->uid, card.uid, card.uid_len);
+    }
+
+    e->last_seen = now;
+    any_present |= 1 << reader;
+    return e->state;
+}
+
+void presence_decoded(uint8_t reader, Card& card) {
+    struct presence_entry *e = lookup(reader, card);
+    if (e) {
+        e->state = PRESENCE_DECODED;
+    }
+}
+
+void presence_expire(Print& p, uint8_t reader) {
+    if (!(any_present & (1 << reader))) {
+        return;
+    }
+
+    unsigned long now = millis();
+    bool present = false;
+
+    for (uint8_t i = 0; i < PRESENCE_MAX; i++) {
+        struct presence_entry *e = &table[i];
+        if (e->state == PRESENCE_DEPARTED || e->reader != reader) {
+            continue;
+        }
+        if ((now - e->last_seen) >= presence_holdoff) {
+            depart(p, e);
+            continue;
+        }
+        present = true;
+    }
+
+    if (!present) {
+        // Show that the card reader is clear of detected cards
+        any_present &= ~(1 << reader);
+        Card none;
+        none.detected = now;
+        none.print_uid_msg(p);
+        if (!(output_flags & OUTPUT_BINARY)) {
+            p.println();
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tracks which cards are currently in front of each reader, so that each
+ * physical card is only decoded once each time it is presented - no matter
+ * how many targets each InAutoPoll returns, or in what order.
+ *
+ * A card that has not been seen for the hold-off time is considered to have
+ * departed, and a gone= message is sent for it.  Once the last card departs
+ * from a reader, the usual uid=NONE message is sent for that reader.
+ */
+#pragma once
+
+#include <Print.h>
+#include <stdint.h>
+
+#include "card.h"
+
+// The PN532 can only report two targets at once, so this is plenty for two
+// readers
+#define PRESENCE_MAX    4
+
+#ifndef PRESENCE_HOLDOFF_MILLIS
+#define PRESENCE_HOLDOFF_MILLIS 500
+#endif
+
+#define PRESENCE_DEPARTED   0   // Not present (and the slot is free)
+#define PRESENCE_ARRIVED    1   // Seen, but not yet decoded
+#define PRESENCE_DECODED    2   // Seen and fully processed
+
+struct presence_entry {
+    uint8_t state;
+    uint8_t reader;
+    uint8_t uid_type;
+    uint8_t uid_len;
+    uint8_t uid[8];
+    unsigned long last_seen;
+};
+
+extern uint16_t presence_holdoff;
+
+// Note that the card is present.  Returns its state, which will be
+// PRESENCE_ARRIVED until presence_decoded() is called for it.
+uint8_t presence_seen(uint8_t reader, Card& card);
+
+void presence_decoded(uint8_t reader, Card& card);
+
+// Send departures for any cards not seen by the reader within the hold-off
+void presence_expire(Print& p, uint8_t reader);
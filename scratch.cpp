@@ -0,0 +1,35 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A statically sized arena for borrowed buffers
+ */
+
+#include <stddef.h>
+
+#include "scratch.h"
+
+static uint8_t arena[SCRATCH_SIZE];
+static uint8_t top;
+static uint8_t high;
+
+Scratch::Scratch(uint8_t size) {
+    mark = top;
+    if (size > SCRATCH_SIZE - top) {
+        buf = NULL;
+        return;
+    }
+    buf = &arena[top];
+    top += size;
+    if (top > high) {
+        high = top;
+    }
+}
+
+Scratch::~Scratch() {
+    top = mark;
+}
+
+uint8_t scratch_high_water(void) {
+    return high;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A statically sized arena that the card decoders borrow their larger
+ * exchange buffers from, instead of each putting its own on the stack.
+ *
+ * Buffers are handed out and returned in stack order, so borrowing is just
+ * declaring a Scratch object - the buffer is returned when it goes out of
+ * scope.  With the arena in .bss, its size shows up in the static RAM use
+ * reported by the build, leaving a smaller and more predictable stack.
+ */
+#pragma once
+
+#include <stdint.h>
+
+// The deepest user is the DESFire path: the 64 byte poll results and then
+// the 58 byte application list
+#ifndef SCRATCH_SIZE
+#define SCRATCH_SIZE 128
+#endif
+
+class Scratch {
+    public:
+        Scratch(uint8_t size);
+        ~Scratch();
+
+        // NULL if there was not enough space left in the arena
+        uint8_t *buf;
+
+    private:
+        uint8_t mark;
+
+        Scratch(const Scratch&) = delete;
+        Scratch& operator=(const Scratch&) = delete;
+};
+
+// The most of the arena that has ever been in use
+uint8_t scratch_high_water(void);
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Lightweight timing statistics
+ */
+
+#include <Arduino.h>
+
+#include "hexdump.h"
+#include "outbuf.h"
+#include "packets.h"
+#include "stats.h"
+
+struct stat {
+    uint8_t key;
+    uint8_t hist[STATS_BUCKETS];    // Each stops counting at 255
+    uint16_t count;
+    uint32_t sum;       // in units of 16us, so it takes hours to overflow
+    uint16_t max;       // in units of 16us, stopping at about a second
+};
+
+// Each kind has a run of slots in the table, with only the keyed kinds
+// having more than one
+#define SLOT_POLL       0
+#define SLOT_EXCHANGE   (SLOT_POLL + 1)
+#define SLOT_DECODE     (SLOT_EXCHANGE + STATS_EXCHANGE_SLOTS)
+#define SLOT_OUTPUT     (SLOT_DECODE + STATS_DECODE_SLOTS)
+#define SLOT_ISR        (SLOT_OUTPUT + 1)
+#define NR_STATS        (SLOT_ISR + 1)
+
+static struct stat stats[NR_STATS];
+
+// The next stat to report, or NR_STATS when not reporting
+static uint8_t report_pos = NR_STATS;
+
+// The largest stats= message, so we can wait for room to send it whole
+#define STATS_MSG_MAX 80
+
+static uint8_t slot_kind(uint8_t i) {
+    if (i < SLOT_EXCHANGE) {
+        return STATS_POLL;
+    }
+    if (i < SLOT_DECODE) {
+        return STATS_EXCHANGE;
+    }
+    if (i < SLOT_OUTPUT) {
+        return STATS_DECODE;
+    }
+    if (i < SLOT_ISR) {
+        return STATS_OUTPUT;
+    }
+    return STATS_ISR;
+}
+
+static struct stat *lookup(uint8_t kind, uint8_t key) {
+    uint8_t first;
+    uint8_t slots = 1;
+    switch (kind) {
+        case STATS_POLL:
+            return &stats[SLOT_POLL];
+        case STATS_OUTPUT:
+            return &stats[SLOT_OUTPUT];
+        case STATS_ISR:
+            return &stats[SLOT_ISR];
+        case STATS_EXCHANGE:
+            first = SLOT_EXCHANGE;
+            slots = STATS_EXCHANGE_SLOTS;
+            break;
+        default:
+            first = SLOT_DECODE;
+            slots = STATS_DECODE_SLOTS;
+            break;
+    }
+
+    struct stat *s = &stats[first];
+    for (uint8_t i = 0; i < slots; i++, s++) {
+        if (s->key == key) {
+            return s;
+        }
+        if (!s->count) {
+            s->key = key;
+            return s;
+        }
+    }
+    // Out of slots, so everything else is counted as "other"
+    s--;
+    s->key = 0xff;
+    return s;
+}
+
+void stats_record(uint8_t kind, uint8_t key, unsigned long us) {
+    struct stat *s = lookup(kind, key);
+
+    uint8_t b = 0;
+    unsigned long v = us >> 6;
+    while (v && b < STATS_BUCKETS - 1) {
+        v >>= 2;
+        b++;
+    }
+    if (s->hist[b] != 0xff) {
+        s->hist[b]++;
+    }
+    if (s->count != 0xffff) {
+        s->count++;
+        s->sum += us >> 4;
+    }
+    unsigned long max = us >> 4;
+    if (max > 0xffff) {
+        max = 0xffff;
+    }
+    if (max > s->max) {
+        s->max = max;
+    }
+}
+
+void stats_start_report() {
+    report_pos = 0;
+}
+
+static void print_name(Print& p, uint8_t kind, uint8_t key) {
+    switch (kind) {
+        case STATS_POLL:
+            p.print(F("poll"));
+            return;
+        case STATS_OUTPUT:
+            p.print(F("output"));
+            return;
+        case STATS_ISR:
+            p.print(F("isr"));
+            return;
+        case STATS_EXCHANGE:
+            p.print('x');
+            break;
+        case STATS_DECODE:
+            p.print('d');
+            break;
+    }
+    hexdump(p, &key, 1);
+}
+
+void stats_report(Print& p) {
+    if (report_pos >= NR_STATS || outbuf.availableForWrite() < STATS_MSG_MAX) {
+        return;
+    }
+
+    uint8_t kind = slot_kind(report_pos);
+    struct stat *s = &stats[report_pos++];
+    bool keyed = (kind == STATS_EXCHANGE || kind == STATS_DECODE);
+    if (keyed && !s->count) {
+        // An unused slot
+        return;
+    }
+
+    struct stat copy = *s;
+    memset(s, 0, sizeof(*s));
+
+    packet_start(p);
+    p.print(F("stats="));
+    print_name(p, kind, copy.key);
+    p.print(',');
+    p.print(copy.count);
+    p.print(',');
+    if (copy.count) {
+        // Careful not to overflow the multiply back to microseconds
+        p.print(copy.sum / copy.count * 16 + (copy.sum % copy.count) * 16 / copy.count);
+    } else {
+        p.print(0);
+    }
+    p.print(',');
+    p.print(copy.max * 16UL);
+    for (uint8_t b = 0; b < STATS_BUCKETS; b++) {
+        p.print(',');
+        p.print(copy.hist[b]);
+    }
+    packet_end(p);
+}
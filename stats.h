@@ -0,0 +1,50 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Lightweight timing statistics, to show where the time goes between a
+ * card entering the field and the cardid= message being sent.
+ *
+ * Each statistic keeps a histogram of durations, in buckets that each
+ * cover four times the range of the previous one:
+ *
+ *      <64us <256us <1ms <4ms <16ms <65ms >=65ms
+ *
+ * along with the count, the total and the maximum.  To keep them small, each
+ * bucket stops counting at 255 and the maximum is kept to 16us.  The
+ * exchange and decode timings are kept separately for each command byte or
+ * card type seen, up to a small number of each (after which they share the
+ * last slot).
+ *
+ * Nothing is recorded from an interrupt, so the LED timer ISR is timed by the
+ * ISR itself and recorded afterwards from the main loop.
+ */
+#pragma once
+
+#include <Print.h>
+#include <stdint.h>
+
+#define STATS_POLL      0   // InAutoPoll
+#define STATS_EXCHANGE  1   // InDataExchange, keyed by the first command byte
+#define STATS_DECODE    2   // Decoding a card, keyed by its cardid type
+#define STATS_OUTPUT    3   // Handing buffered output to the serial port
+#define STATS_ISR       4   // The LED timer interrupt, see ledtimer_isr_time()
+
+#define STATS_BUCKETS   7
+
+#ifndef STATS_EXCHANGE_SLOTS
+#define STATS_EXCHANGE_SLOTS 4
+#endif
+#ifndef STATS_DECODE_SLOTS
+#define STATS_DECODE_SLOTS 3
+#endif
+
+void stats_record(uint8_t kind, uint8_t key, unsigned long us);
+
+// Start sending the stats= messages.  As there are many of them, they are
+// sent one at a time by stats_report(), as space in the output allows.
+void stats_start_report();
+
+// Send the next stats= message, if one is due and there is room for it.
+// Each statistic is reset once it has been sent.
+void stats_report(Print& p);
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Capture of PN532 transcripts in a compact binary trace format
+ */
+
+#include <Arduino.h>
+
+#include "arduino_cardreader.h"
+#include "hexdump.h"
+#include "outbuf.h"
+#include "packets.h"
+#include "pn532.h"
+#include "trace.h"
+
+static bool last_poll_empty = false;
+
+static void trace_start(uint8_t type, unsigned long start) {
+    unsigned long duration = (micros() - start) / TRACE_DURATION_US;
+    if (duration > 0xffff) {
+        duration = 0xffff;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    header[0] = type;
+    header[1] = start;
+    header[2] = start >> 8;
+    header[3] = start >> 16;
+    header[4] = start >> 24;
+    header[5] = duration;
+    header[6] = duration >> 8;
+
+    packet_start(outbuf);
+    outbuf.print(F("trace="));
+    hexdump(outbuf, header, sizeof(header));
+}
+
+void trace_autopoll(unsigned long start, uint8_t found, uint8_t *buf, uint8_t buflen) {
+    if (!(output_flags & OUTPUT_TRACE)) {
+        return;
+    }
+    if (!found && last_poll_empty) {
+        return;
+    }
+    last_poll_empty = !found;
+
+    uint8_t len = pn532_autopoll_len(buf, found, buflen);
+
+    trace_start(TRACE_AUTOPOLL, start);
+    hexdump(outbuf, &found, 1);
+    hexdump(outbuf, &len, 1);
+    hexdump(outbuf, buf, len);
+    packet_end(outbuf);
+}
+
+void trace_exchange(unsigned long start, uint8_t tg, bool ok, uint8_t *cmd, uint8_t cmdlen, uint8_t *res, uint8_t reslen) {
+    if (!(output_flags & OUTPUT_TRACE)) {
+        return;
+    }
+
+    uint8_t status = ok;
+
+    trace_start(TRACE_EXCHANGE, start);
+    hexdump(outbuf, &tg, 1);
+    hexdump(outbuf, &status, 1);
+    hexdump(outbuf, &cmdlen, 1);
+    hexdump(outbuf, cmd, cmdlen);
+    hexdump(outbuf, &reslen, 1);
+    hexdump(outbuf, res, reslen);
+    packet_end(outbuf);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2024 Hamish Coleman
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Capture of PN532 transcripts in a compact binary trace format
+ *
+ * When capture is enabled (the "c" command), every InAutoPoll result and
+ * InDataExchange request/response pair is sent as a "trace=" message, with
+ * the binary record hexdumped as the value.  Concatenating the records
+ * (after a file header) gives a trace file that can be replayed on the host
+ * without a reader attached.
+ *
+ * All multi-byte values are little endian.  Each record is:
+ *
+ *      u8  type            TRACE_AUTOPOLL or TRACE_EXCHANGE
+ *      u32 timestamp       micros() when the operation started
+ *      u16 duration        in units of TRACE_DURATION_US, saturating
+ *
+ * followed by, for TRACE_AUTOPOLL:
+ *
+ *      u8  found           number of targets
+ *      u8  len             length of the poll data
+ *      u8  data[len]       the targets, as returned by InAutoPoll
+ *
+ * or for TRACE_EXCHANGE:
+ *
+ *      u8  tg              the target number
+ *      u8  ok              the InDataExchange result
+ *      u8  cmdlen
+ *      u8  cmd[cmdlen]
+ *      u8  reslen          zero if the exchange failed
+ *      u8  res[reslen]
+ *
+ * Consecutive empty polls are only recorded once.  The replay repeats an
+ * empty poll until the next record is due, so that the sketch still sees a
+ * card leave.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define TRACE_MAGIC         "PN5T"
+#define TRACE_VERSION       1
+
+#define TRACE_AUTOPOLL      0x01
+#define TRACE_EXCHANGE      0x02
+
+#define TRACE_HEADER_SIZE   7
+#define TRACE_DURATION_US   16
+
+void trace_autopoll(unsigned long start, uint8_t found, uint8_t *buf, uint8_t buflen);
+void trace_exchange(unsigned long start, uint8_t tg, bool ok, uint8_t *cmd, uint8_t cmdlen, uint8_t *res, uint8_t reslen);